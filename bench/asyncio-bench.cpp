@@ -0,0 +1,95 @@
+/*
+ * compares random reads using blocking pread with asyncio at various queue depths.
+ *
+ * Usage: asyncio-bench [-b blocksize] [-n nreads] [-s filesize] [-t] [filename]
+ *
+ *   -t  use the thread pool instead of io_uring.
+ *
+ * Without a filename, a temporary file of `filesize` bytes is created.
+ * Note that for a meaningful comparison the file should not be in the page cache,
+ * use a block device, or drop the caches before running.
+ */
+#include <cpputils/asyncio.h>
+#include <cpputils/argparse.h>
+#include <cpputils/formatter.h>
+#include <cpputils/HiresTimer.h>
+
+#include <random>
+#include <vector>
+#include <stdlib.h>
+
+int main(int argc, char**argv)
+{
+    size_t blocksize = 4096;
+    size_t nreads = 100000;
+    uint64_t filesize = 256*1024*1024;
+    bool usethreads = false;
+    std::string filename;
+
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'b': blocksize = arg.getint(); break;
+            case 'n': nreads = arg.getint(); break;
+            case 's': filesize = arg.getint(); break;
+            case 't': usethreads = true; break;
+            case -1: filename = arg.getstr(); break;
+            default:
+                print("Usage: asyncio-bench [-b blocksize] [-n nreads] [-s filesize] [-t] [filename]\n");
+                return 1;
+        }
+
+    filehandle f;
+    if (filename.empty()) {
+        char name[] = "/tmp/asyncio-bench-XXXXXX";
+        f = mkstemp(name);
+        ::unlink(name);
+        std::vector<uint8_t> chunk(1024*1024, 0x55);
+        for (uint64_t ofs = 0 ; ofs < filesize ; ofs += chunk.size())
+            f.write(chunk.data(), chunk.size());
+    }
+    else {
+        f.open(filename);
+        filesize = f.size();
+    }
+
+    std::mt19937_64 rng(1234);
+    std::vector<uint64_t> offsets(nreads);
+    for (auto& ofs : offsets)
+        ofs = (rng() % (filesize/blocksize)) * blocksize;
+
+    HiresTimer t;
+    std::vector<uint8_t> buf(blocksize);
+    for (auto ofs : offsets)
+        f.pread(ofs, buf.data(), blocksize);
+    auto usec = t.elapsed();
+    print("blocking pread       : %8.0f reads/sec\n", nreads*1e6/usec);
+
+    for (unsigned qd : { 1, 2, 4, 8, 16, 32, 64, 128 }) {
+        asyncio aio(qd, usethreads ? asyncio::THREADS : asyncio::AUTO);
+        std::vector<uint8_t> bufs(qd*blocksize);
+
+        // keep qd requests in flight, each completion queues the next read,
+        // which are submitted in a batch after each wait.
+        size_t next = 0;
+        std::function<void(int64_t, size_t)> issue;
+        issue = [&](int64_t res, size_t slot) {
+            if (res < 0)
+                throw std::system_error(-res, std::generic_category(), "pread");
+            if (next == nreads)
+                return;
+            aio.pread(f, offsets[next++], &bufs[slot*blocksize], blocksize, [&issue, slot](int64_t res) { issue(res, slot); });
+        };
+
+        t.reset();
+        for (size_t slot = 0 ; slot < qd ; slot++)
+            issue(0, slot);
+        aio.submit();
+        while (aio.inflight()) {
+            aio.waitsome();
+            aio.submit();
+        }
+        usec = t.elapsed();
+        print("asyncio %-6s qd=%3d : %8.0f reads/sec\n", aio.usesuring() ? "uring" : "thread", qd, nreads*1e6/usec);
+    }
+}
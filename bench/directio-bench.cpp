@@ -0,0 +1,74 @@
+/*
+ * compares sequential read throughput through the page cache with O_DIRECT reads.
+ *
+ * Usage: directio-bench [-b blocksize] [-s filesize] [filename]
+ *
+ * Without a filename, a temporary file of `filesize` bytes is created in /var/tmp.
+ * Note that the cached reads are only meaningful when the file is not already
+ * in the page cache, use a block device, or drop the caches before running.
+ */
+#include <cpputils/directio.h>
+#include <cpputils/argparse.h>
+#include <cpputils/formatter.h>
+#include <cpputils/HiresTimer.h>
+
+#include <vector>
+#include <stdlib.h>
+
+int main(int argc, char**argv)
+{
+    size_t blocksize = 1024*1024;
+    uint64_t filesize = 1024*1024*1024;
+    std::string filename;
+
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'b': blocksize = arg.getint(); break;
+            case 's': filesize = arg.getint(); break;
+            case -1: filename = arg.getstr(); break;
+            default:
+                print("Usage: directio-bench [-b blocksize] [-s filesize] [filename]\n");
+                return 1;
+        }
+
+    if (filename.empty()) {
+        char name[] = "/var/tmp/directio-bench-XXXXXX";
+        filehandle f = mkstemp(name);
+        filename = name;
+        std::vector<uint8_t> chunk(1024*1024, 0x55);
+        for (uint64_t ofs = 0 ; ofs < filesize ; ofs += chunk.size())
+            f.write(chunk.data(), chunk.size());
+    }
+    else {
+        filesize = filehandle(filename).size();
+    }
+
+    filehandle cached(filename);
+    std::vector<uint8_t> buf(blocksize);
+    HiresTimer t;
+    for (uint64_t ofs = 0 ; ofs < filesize ; ofs += blocksize)
+        cached.pread(ofs, buf.data(), blocksize);
+    auto usec = t.elapsed();
+    print("cached pread     : %8.1f MB/sec\n", filesize/usec);
+
+    directfile direct(filename, O_RDONLY, 0666, blocksize);
+    print("logical blocksize: %d, memory alignment: %d\n", direct.blocksize(), direct.memalign());
+
+    auto abuf = direct.pool().get();
+    t.reset();
+    for (uint64_t ofs = 0 ; ofs < filesize ; ofs += abuf.size())
+        direct.pread(ofs, abuf.data(), abuf.size());
+    usec = t.elapsed();
+    print("direct pread     : %8.1f MB/sec\n", filesize/usec);
+
+    // unaligned reads go through the bounce buffers.
+    t.reset();
+    for (uint64_t ofs = 1 ; ofs < filesize ; ofs += blocksize)
+        direct.pread(ofs, buf.data(), blocksize);
+    usec = t.elapsed();
+    print("direct unaligned : %8.1f MB/sec\n", filesize/usec);
+
+    if (filename.starts_with("/var/tmp/directio-bench-"))
+        ::unlink(filename.c_str());
+}
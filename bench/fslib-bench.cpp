@@ -0,0 +1,81 @@
+/*
+ * compares reading a large directory with readdir, with reading it in bulk using getdents64.
+ *
+ * Usage: fslib-bench [-n nfiles] [-b bufsize] [dirname]
+ *
+ * Without a dirname, a temporary directory containing `nfiles` empty files is created in /var/tmp.
+ */
+#include <cpputils/fslibrary.h>
+#include <cpputils/argparse.h>
+#include <cpputils/formatter.h>
+#include <cpputils/HiresTimer.h>
+
+#include <filesystem>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+template<typename STREAM>
+void readall(const char *title, STREAM& d, const std::string& dirname)
+{
+    HiresTimer t;
+    uint64_t n = 0;
+    if (!d.open(dirname.c_str())) {
+        print("%s: can't open %s\n", title, dirname);
+        return;
+    }
+    while (d.next())
+        n++;
+    d.close();
+    double usec = t.elapsed();
+    print("%-10s: %8d entries, %8.1f msec, %6.1f Mentries/sec\n", title, n, usec/1000, n/usec);
+}
+
+int main(int argc, char**argv)
+{
+    int nfiles = 1000000;
+    size_t bufsize = 0x40000;
+    std::string dirname;
+    bool created = false;
+
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'n': nfiles = arg.getint(); break;
+            case 'b': bufsize = arg.getint(); break;
+            case -1: dirname = arg.getstr(); break;
+            default:
+                print("Usage: fslib-bench [-n nfiles] [-b bufsize] [dirname]\n");
+                return 1;
+        }
+
+    if (dirname.empty()) {
+        char name[] = "/var/tmp/fslib-bench-XXXXXX";
+        dirname = mkdtemp(name);
+        created = true;
+        int dirfd = ::open(dirname.c_str(), O_RDONLY|O_DIRECTORY);
+        for (int i = 0 ; i < nfiles ; i++)
+            ::close(::openat(dirfd, stringformat("file%08d", i).c_str(), O_CREAT|O_WRONLY, 0666));
+        ::close(dirfd);
+    }
+
+    for (int pass = 0 ; pass < 2 ; pass++) {
+        fileenumerator::readdirstream rd;
+        readall("readdir", rd, dirname);
+#ifdef FSLIB_HAVE_GETDENTS
+        fileenumerator::getdentsstream gd(bufsize);
+        readall("getdents64", gd, dirname);
+#endif
+    }
+
+    HiresTimer t;
+    uint64_t n = 0;
+    for (auto [fn, ent] : fileenumerator(dirname)) {
+        n += fn.size() > 0;
+    }
+    double usec = t.elapsed();
+    print("%-10s: %8d entries, %8.1f msec, %6.1f Mentries/sec\n", "enumerator", n, usec/1000, n/usec);
+
+    if (created)
+        std::filesystem::remove_all(dirname);
+}
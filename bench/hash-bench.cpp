@@ -0,0 +1,87 @@
+/*
+ * compares hashing a synthetic tree serially, with the parallel hashpipeline.
+ *
+ * Usage: hash-bench [-d ndirs] [-f filesperdir] [-s filesize] [-t maxthreads] [dirname]
+ *
+ * Without a dirname, a temporary tree is created in /var/tmp.
+ * Note that the first pass reads from disk, the other passes likely from the page cache.
+ */
+#include <cpputils/hashpipeline.h>
+#include <cpputils/argparse.h>
+#include <cpputils/formatter.h>
+#include <cpputils/HiresTimer.h>
+
+#include <filesystem>
+#include <vector>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+int main(int argc, char**argv)
+{
+    int ndirs = 16;
+    int nfiles = 64;
+    uint64_t filesize = 1024*1024;
+    unsigned maxthreads = std::max(4u, std::thread::hardware_concurrency());
+    std::string dirname;
+    bool created = false;
+
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 'd': ndirs = arg.getint(); break;
+            case 'f': nfiles = arg.getint(); break;
+            case 's': filesize = arg.getint(); break;
+            case 't': maxthreads = arg.getint(); break;
+            case -1: dirname = arg.getstr(); break;
+            default:
+                print("Usage: hash-bench [-d ndirs] [-f filesperdir] [-s filesize] [-t maxthreads] [dirname]\n");
+                return 1;
+        }
+
+    if (dirname.empty()) {
+        char name[] = "/var/tmp/hash-bench-XXXXXX";
+        dirname = mkdtemp(name);
+        created = true;
+        std::vector<uint8_t> data(filesize);
+        for (int d = 0 ; d < ndirs ; d++) {
+            auto dn = stringformat("%s/dir%d", dirname, d);
+            ::mkdir(dn.c_str(), 0777);
+            for (int f = 0 ; f < nfiles ; f++) {
+                for (auto& b : data)
+                    b = rand();
+                filehandle fh(stringformat("%s/file%d", dn, f), O_RDWR|O_CREAT|O_TRUNC);
+                fh.write(data.data(), data.size());
+            }
+        }
+    }
+
+    {
+        HiresTimer t;
+        uint64_t bytes = 0;
+        std::vector<uint8_t> buf(0x100000);
+        for (auto [fn, ent] : fileenumerator(dirname, fileenumerator::FILT_REGULAR)) {
+            filehandle f{std::string(fn)};
+            uint32_t crc = ~uint32_t(0);
+            while (size_t n = f.read(buf.data(), buf.size())) {
+                crc = crc32(crc, buf.data(), n);
+                bytes += n;
+            }
+        }
+        double usec = t.elapsed();
+        print("serial     : %8.1f MB/sec\n", bytes/usec);
+    }
+
+    for (unsigned nthreads = 1 ; nthreads <= maxthreads ; nthreads *= 2) {
+        HiresTimer t;
+        hashpipeline hp(dirname, { .nthreads = nthreads });
+        uint64_t nresults = 0;
+        while (hp.next())
+            nresults++;
+        double usec = t.elapsed();
+        print("%2d threads : %8.1f MB/sec, %d files\n", nthreads, hp.bytes()/usec, nresults);
+    }
+
+    if (created)
+        std::filesystem::remove_all(dirname);
+}
@@ -0,0 +1,121 @@
+/*
+ * measures the xml tokenizer throughput on a synthetic document.
+ *
+ * Usage: xml-bench [-s sizeinmb] [-n repeat] [filename]
+ *
+ * Compares locating the structural characters with the 64 byte block scanner,
+ * with a byte at a time loop, and reports the speed of a complete XmlSaxParser pass,
+ * and of encoding and decoding entities.
+ */
+#include <cpputils/xmlparser.h>
+#include <cpputils/argparse.h>
+#include <cpputils/formatter.h>
+#include <cpputils/HiresTimer.h>
+#include <cpputils/fhandle.h>
+
+#include <vector>
+#include <string>
+#include <fcntl.h>
+
+struct Counter : XmlSaxParser<Counter> {
+    size_t tags = 0;
+    size_t attrs = 0;
+    size_t databytes = 0;
+    void on_starttag(std::string_view tag, const XmlAttributeView& a) { tags++; attrs += a.size(); }
+    void on_element(std::string_view tag, const XmlAttributeView& a) { tags++; attrs += a.size(); }
+    void on_data(std::string_view data) { databytes += data.size(); }
+};
+
+std::string makedoc(size_t size)
+{
+    std::string doc = "<?xml version=\"1.0\"?>\n<root>\n";
+    int i = 0;
+    while (doc.size() < size) {
+        doc += stringformat("  <record id=\"%d\" type='item' name=\"element number %d\">\n", i, i);
+        doc += stringformat("    <description>a longer piece of text, without any markup, as found in most documents: %d</description>\n", i*7);
+        doc += "    <!-- a comment, with a > inside -->\n";
+        doc += stringformat("    <value unit=\"m\" scale='1'/>%d\n  </record>\n", i*13);
+        i++;
+    }
+    doc += "</root>\n";
+    return doc;
+}
+
+int main(int argc, char**argv)
+{
+    size_t sizemb = 64;
+    int repeat = 5;
+    std::string filename;
+
+    for (auto& arg : ArgParser(argc, argv))
+        switch (arg.option())
+        {
+            case 's': sizemb = arg.getint(); break;
+            case 'n': repeat = arg.getint(); break;
+            case -1: filename = arg.getstr(); break;
+            default:
+                print("Usage: xml-bench [-s sizeinmb] [-n repeat] [filename]\n");
+                return 1;
+        }
+
+    std::string doc;
+    if (filename.empty()) {
+        doc = makedoc(sizemb << 20);
+    }
+    else {
+        filehandle f(filename);
+        char buf[0x10000];
+        while (size_t n = f.read(buf, sizeof(buf)))
+            doc.append(buf, n);
+    }
+    const char *first = doc.data();
+    const char *last = first + doc.size();
+
+    std::vector<uint32_t> positions;
+    positions.reserve(doc.size() / 4);
+    for (int r = 0 ; r < repeat ; r++) {
+        {
+            positions.clear();
+            HiresTimer t;
+            for (const char *p = first ; p < last ; ++p)
+                if (xmlscan::isstructural(*p))
+                    positions.push_back(uint32_t(p - first));
+            double usec = t.elapsed();
+            print("scalar index : %8.1f MB/sec, %d positions\n", doc.size()/usec, positions.size());
+        }
+        {
+            positions.clear();
+            HiresTimer t;
+            xmlscan::index(first, last, positions);
+            double usec = t.elapsed();
+            print("block index  : %8.1f MB/sec, %d positions\n", doc.size()/usec, positions.size());
+        }
+        {
+            HiresTimer t;
+            size_t n = 0;
+            for (const char *p = first ; (p = xmlscan::find_char(p, last, '<')) != last ; ++p)
+                n++;
+            double usec = t.elapsed();
+            print("find '<'     : %8.1f MB/sec, %d tags\n", doc.size()/usec, n);
+        }
+        {
+            Counter c;
+            HiresTimer t;
+            c.parse(doc);
+            double usec = t.elapsed();
+            print("sax parse    : %8.1f MB/sec, %d tags, %d attrs, %d data bytes\n", doc.size()/usec, c.tags, c.attrs, c.databytes);
+        }
+        {
+            std::string buf, back;
+            HiresTimer t;
+            auto enc = XmlParserBase::encode_entities(doc, buf);
+            double usec = t.elapsed();
+            print("encode       : %8.1f MB/sec, %d bytes\n", doc.size()/usec, enc.size());
+
+            t = HiresTimer();
+            auto dec = XmlParserBase::decode_entities(enc, back);
+            usec = t.elapsed();
+            print("decode       : %8.1f MB/sec, %s\n", enc.size()/usec, dec == doc ? "ok" : "mismatch");
+        }
+    }
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include <cpputils/mmem.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+ * Anonymous memory mapping, for large in-memory buffers.
+ *
+ *   anonmem buf(1024*1024*1024, anonmem::POPULATE | anonmem::HUGEPAGES);
+ *   buf.resize(2048*1024*1024);
+ *
+ * Options:
+ *   - POPULATE:  prefault all pages, so later accesses don't page fault.
+ *   - HUGETLB:   use explicit huge pages, falling back to transparent huge pages
+ *                when no huge pages are reserved, see `usinghugetlb`.
+ *   - HUGEPAGES: ask for transparent huge pages.
+ *
+ * When a `numanode` is specified, the memory is bound to that NUMA node,
+ * before it is populated.
+ */
+struct anonmem : mappedmem {
+    enum {
+        POPULATE = 1,
+        HUGETLB = 2,
+        HUGEPAGES = 4,
+    };
+    // x86 and arm64 use 2M huge pages by default.
+    static constexpr uint64_t hugepagesize = 0x200000;
+
+    int _options;
+    int _numanode;
+    bool _hugetlb;
+
+    anonmem(uint64_t size, int options = 0, int numanode = -1)
+        : anonmem(allocate(size, options), size, options, numanode)
+    {
+    }
+
+    // true when the memory uses explicit huge pages.
+    bool usinghugetlb() const { return _hugetlb; }
+
+    // change the size, the contents are preserved.
+    // returns true when addresses stayed the same.
+    bool resize(uint64_t newsize)
+    {
+#ifndef MREMAP_MAYMOVE
+        throw std::runtime_error("anonmem.resize not supported");
+#else
+        uint64_t newphys = round_up(std::max(newsize, uint64_t(1)), pagesize(_hugetlb));
+        uint8_t *newaddr = (uint8_t *)mremap(pmem, phys_length, newphys, MREMAP_MAYMOVE);
+        if (newaddr==MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mremap");
+
+        bool havemoved = newaddr!=pmem;
+        uint64_t oldphys = phys_length;
+        pmem = newaddr;
+        phys_length = newphys;
+        length = newsize;
+
+        if (newphys > oldphys)
+            setup(oldphys, newphys - oldphys);
+        return !havemoved;
+#endif
+    }
+
+    // bind the range ofs..ofs+len to a numa node, moving pages already allocated.
+    void bindnode(int node, uint64_t ofs = 0, uint64_t len = ~uint64_t(0))
+    {
+        clip(ofs, len);
+        bindrange(pmem + ofs, len, node);
+    }
+
+private:
+    struct allocation {
+        uint8_t *ptr;
+        uint64_t physlength;
+        bool hugetlb;
+    };
+
+    anonmem(const allocation& a, uint64_t size, int options, int numanode)
+        : mappedmem(a.ptr, a.physlength, size), _options(options), _numanode(numanode), _hugetlb(a.hugetlb)
+    {
+        setup(0, phys_length);
+    }
+
+    static uint64_t pagesize(bool hugetlb)
+    {
+        return hugetlb ? hugepagesize : std::max(0x1000, (int)sysconf(_SC_PAGE_SIZE));
+    }
+
+    static allocation allocate(uint64_t size, int options)
+    {
+        size = std::max(size, uint64_t(1));
+#ifdef MAP_HUGETLB
+        if (options & HUGETLB) {
+            uint64_t physlength = round_up(size, hugepagesize);
+            void *p = mmap(NULL, physlength, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+                return { (uint8_t*)p, physlength, true };
+            // no huge pages reserved, fall back to normal pages.
+        }
+#endif
+        uint64_t physlength = round_up(size, pagesize(false));
+        void *p = mmap(NULL, physlength, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        return { (uint8_t*)p, physlength, false };
+    }
+
+    void bindrange(uint8_t *ptr, uint64_t len, int node)
+    {
+#ifdef __linux__
+        uint64_t first = round_down(uint64_t(ptr), pagesize(_hugetlb));
+        uint64_t last = round_up(uint64_t(ptr) + len, pagesize(_hugetlb));
+        if (first == last)
+            return;
+        unsigned long nodemask[16] = {};
+        if (node < 0 || node >= int(sizeof(nodemask)*8))
+            throw std::runtime_error("anonmem: invalid numa node");
+        nodemask[node / (8*sizeof(long))] |= 1UL << (node % (8*sizeof(long)));
+        if (syscall(__NR_mbind, first, last - first, MPOL_BIND, nodemask, sizeof(nodemask)*8, MPOL_MF_MOVE))
+            throw std::system_error(errno, std::generic_category(), "mbind");
+#else
+        throw std::runtime_error("anonmem: numa binding not supported");
+#endif
+    }
+
+    // apply the options to a newly mapped range.
+    void setup(uint64_t ofs, uint64_t len)
+    {
+        if (!_hugetlb && (_options & (HUGETLB|HUGEPAGES)))
+            adviserange(pmem + ofs, len, HUGEPAGE);
+        if (_numanode >= 0)
+            bindrange(pmem + ofs, len, _numanode);
+        if (_options & POPULATE)
+            populatewrite(pmem + ofs, len);
+    }
+
+    // prefault for writing, populating for reading would only map the zero page.
+    void populatewrite(uint8_t *ptr, uint64_t len)
+    {
+#ifdef MADV_POPULATE_WRITE
+        if (0 == madvise(ptr, len, MADV_POPULATE_WRITE))
+            return;
+        if (errno != EINVAL)
+            throw std::system_error(errno, std::generic_category(), "madvise(POPULATE_WRITE)");
+#endif
+        uint64_t step = pagesize(_hugetlb);
+        for (uint64_t o = 0 ; o < len ; o += step)
+            *(volatile uint8_t*)(ptr + o) = 0;
+    }
+};
@@ -0,0 +1,436 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <system_error>
+#include <exception>
+#include <initializer_list>
+
+#include <cpputils/fhandle.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <cpputils/mmem.h>
+#endif
+
+/*
+ * Asynchronous pread/pwrite on filehandles.
+ *
+ * Requests are queued with `pread` or `pwrite`, and passed to the kernel
+ * in a batch by `submit`.  Completions are reported from `poll` or `wait`,
+ * by calling the callback, or via the returned std::future.
+ * Callbacks are always called from the thread calling poll or wait.
+ *
+ * At most `queuedepth` requests are in flight, more requests are kept
+ * in a pending queue until earlier requests complete.
+ *
+ * On linux io_uring is used, when that is not available, a pool of
+ * threads performs blocking pread/pwrite calls.
+ *
+ *   asyncio aio(32);
+ *   aio.pread(f, ofs, buf, size, [](int64_t res) { ... });
+ *   auto fut = aio.pread(f, ofs2, buf2, size);
+ *   aio.submit();
+ *   aio.wait();
+ *   size_t n = fut.get();
+ *
+ * The callback receives the number of bytes transferred, or -errno.
+ * When callbacks throw, all other completions are still reported, then the first
+ * exception is rethrown from poll or wait.
+ *
+ * A single request transfers at most `maxcount` bytes, the linux limit for one read or write.
+ */
+class asyncio {
+public:
+    using callback = std::function<void(int64_t result)>;
+
+    enum Backend {
+        AUTO,       // io_uring when available, otherwise threads.
+        URING,
+        THREADS,
+    };
+    static constexpr size_t maxcount = 0x7ffff000;
+private:
+    enum { OP_READ, OP_WRITE };
+    struct request {
+        filehandle f;
+        int op;
+        uint64_t ofs;
+        void *ptr;
+        size_t count;
+        callback cb;
+        int64_t result = 0;
+    };
+    using requestptr = std::unique_ptr<request>;
+
+    unsigned _queuedepth;
+    size_t _inflight = 0;           // submitted, but not yet reported.
+    std::deque<requestptr> _queued; // not yet submitted.
+    std::deque<requestptr> _pending;  // submitted, but exceeding queuedepth.
+
+#ifdef __linux__
+    // a minimal io_uring, without liburing.
+    struct uring {
+        io_uring_params params{};
+        filehandle fd;
+        mappedmem sq;
+        mappedmem cq;
+        mappedmem sqes;
+
+        static int setup(unsigned entries, io_uring_params& params)
+        {
+            int fd = syscall(__NR_io_uring_setup, entries, &params);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+            return fd;
+        }
+
+        uring(unsigned entries)
+            : fd(setup(entries, params)),
+              sq(fd, IORING_OFF_SQ_RING, IORING_OFF_SQ_RING + params.sq_off.array + params.sq_entries*sizeof(unsigned)),
+              cq(fd, IORING_OFF_CQ_RING, IORING_OFF_CQ_RING + params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe)),
+              sqes(fd, IORING_OFF_SQES, IORING_OFF_SQES + params.sq_entries*sizeof(io_uring_sqe))
+        {
+            // IORING_OP_READ and WRITE were added in linux 5.6, older kernels with
+            // io_uring fail these with EINVAL. The probe was added in the same version.
+            if (!supports({ IORING_OP_READ, IORING_OP_WRITE }))
+                throw std::system_error(ENOSYS, std::generic_category(), "io_uring: no IORING_OP_READ/WRITE");
+        }
+
+        bool supports(std::initializer_list<unsigned> opcodes)
+        {
+            std::vector<uint8_t> buf(sizeof(io_uring_probe) + 256*sizeof(io_uring_probe_op));
+            auto probe = (io_uring_probe*)buf.data();
+            if (syscall(__NR_io_uring_register, (int)fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+                return false;
+            for (auto op : opcodes)
+                if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                    return false;
+            return true;
+        }
+
+        unsigned& sqfield(unsigned ofs) { return *(unsigned*)(sq.data() + ofs); }
+        unsigned& cqfield(unsigned ofs) { return *(unsigned*)(cq.data() + ofs); }
+
+        // returns nullptr when the submission queue is full.
+        io_uring_sqe *getsqe()
+        {
+            unsigned head = std::atomic_ref(sqfield(params.sq_off.head)).load(std::memory_order_acquire);
+            unsigned tail = sqfield(params.sq_off.tail);
+            if (tail - head >= params.sq_entries)
+                return nullptr;
+            unsigned ix = tail & sqfield(params.sq_off.ring_mask);
+            ((unsigned*)(sq.data() + params.sq_off.array))[ix] = ix;
+
+            auto sqe = (io_uring_sqe*)sqes.data() + ix;
+            *sqe = io_uring_sqe{};
+            return sqe;
+        }
+        void advancesq()
+        {
+            auto& tail = sqfield(params.sq_off.tail);
+            std::atomic_ref(tail).store(tail+1, std::memory_order_release);
+        }
+        // submit all sqes, and optionally wait for `mincomplete` completions.
+        void enter(unsigned mincomplete)
+        {
+            while (true) {
+                unsigned head = std::atomic_ref(sqfield(params.sq_off.head)).load(std::memory_order_acquire);
+                unsigned tosubmit = sqfield(params.sq_off.tail) - head;
+                if (tosubmit==0 && mincomplete==0)
+                    return;
+                int rc = syscall(__NR_io_uring_enter, (int)fd, tosubmit, mincomplete, mincomplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+                if (rc >= 0)
+                    return;
+                if (errno != EINTR && errno != EAGAIN)
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+        }
+
+        // call fn(user_data, res) for each completion
+        template<typename FN>
+        size_t reap(FN fn)
+        {
+            auto& head = cqfield(params.cq_off.head);
+            unsigned tail = std::atomic_ref(cqfield(params.cq_off.tail)).load(std::memory_order_acquire);
+            unsigned mask = cqfield(params.cq_off.ring_mask);
+            auto cqes = (io_uring_cqe*)(cq.data() + params.cq_off.cqes);
+            size_t n = 0;
+            for (unsigned i = head ; i != tail ; i++, n++) {
+                auto& cqe = cqes[i & mask];
+                fn(cqe.user_data, cqe.res);
+            }
+            std::atomic_ref(head).store(tail, std::memory_order_release);
+            return n;
+        }
+    };
+    std::unique_ptr<uring> _ring;
+#endif
+
+    // the thread pool backend
+    std::vector<std::thread> _threads;
+    std::mutex _mtx;
+    std::condition_variable _workcv;    // signals workers
+    std::condition_variable _donecv;    // signals completions
+    std::deque<request*> _work;
+    std::deque<request*> _done;
+    bool _stopping = false;
+
+public:
+    asyncio(unsigned queuedepth = 64, Backend backend = AUTO)
+        : _queuedepth(queuedepth)
+    {
+        if (queuedepth == 0)
+            throw std::runtime_error("asyncio: queuedepth must be > 0");
+#ifdef __linux__
+        if (backend != THREADS) {
+            try {
+                _ring = std::make_unique<uring>(queuedepth);
+            }
+            catch (const std::system_error&) {
+                if (backend == URING)
+                    throw;
+            }
+        }
+        if (_ring)
+            return;
+#else
+        if (backend == URING)
+            throw std::runtime_error("asyncio: io_uring not available");
+#endif
+        unsigned nthreads = std::min(queuedepth, std::max(4u, std::thread::hardware_concurrency()));
+        for (unsigned i = 0 ; i < nthreads ; i++)
+            _threads.emplace_back([this]() { worker(); });
+    }
+    asyncio(const asyncio&) = delete;
+    ~asyncio()
+    {
+        // keep draining after a throwing callback, no request may still write into
+        // the caller's buffers once the threads and the ring are gone.
+        while (_inflight) {
+            try {
+                waitsome();
+            }
+            catch (...) {
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stopping = true;
+        }
+        _workcv.notify_all();
+        for (auto& t : _threads)
+            t.join();
+    }
+
+    bool usesuring() const
+    {
+#ifdef __linux__
+        return _ring != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    // number of requests submitted, and not yet reported.
+    size_t inflight() const { return _inflight; }
+
+    void pread(const filehandle& f, uint64_t ofs, void *ptr, size_t count, callback cb)
+    {
+        checkcount(count);
+        _queued.push_back(requestptr(new request{f, OP_READ, ofs, ptr, count, cb}));
+    }
+    void pwrite(const filehandle& f, uint64_t ofs, const void *ptr, size_t count, callback cb)
+    {
+        checkcount(count);
+        _queued.push_back(requestptr(new request{f, OP_WRITE, ofs, (void*)ptr, count, cb}));
+    }
+    std::future<size_t> pread(const filehandle& f, uint64_t ofs, void *ptr, size_t count)
+    {
+        auto prom = std::make_shared<std::promise<size_t>>();
+        pread(f, ofs, ptr, count, [prom](int64_t res) { setresult(*prom, res, "pread"); });
+        return prom->get_future();
+    }
+    std::future<size_t> pwrite(const filehandle& f, uint64_t ofs, const void *ptr, size_t count)
+    {
+        auto prom = std::make_shared<std::promise<size_t>>();
+        pwrite(f, ofs, ptr, count, [prom](int64_t res) { setresult(*prom, res, "pwrite"); });
+        return prom->get_future();
+    }
+
+    // pass all queued requests to the kernel, or the thread pool.
+    void submit()
+    {
+        while (!_queued.empty()) {
+            _pending.push_back(std::move(_queued.front()));
+            _queued.pop_front();
+            _inflight++;
+        }
+        startpending();
+    }
+
+    // report completed requests, without blocking.
+    // returns the number of requests reported.
+    size_t poll()
+    {
+        size_t n = complete();
+        startpending();
+        return n;
+    }
+
+    // block until at least one request has been reported.
+    // returns the number of requests reported.
+    size_t waitsome()
+    {
+        while (_inflight) {
+            if (size_t n = poll())
+                return n;
+#ifdef __linux__
+            if (_ring) {
+                _ring->enter(1);
+                continue;
+            }
+#endif
+            std::unique_lock<std::mutex> lock(_mtx);
+            _donecv.wait(lock, [this]() { return !_done.empty(); });
+        }
+        return 0;
+    }
+
+    // block until all submitted requests have been reported.
+    void wait()
+    {
+        while (_inflight)
+            waitsome();
+    }
+private:
+    // the sqe length field is 32 bits, reject larger requests instead of silently truncating them.
+    static void checkcount(size_t count)
+    {
+        if (count > maxcount)
+            throw std::system_error(EINVAL, std::generic_category(), "asyncio: request larger than maxcount");
+    }
+    static void setresult(std::promise<size_t>& prom, int64_t res, const char *what)
+    {
+        if (res < 0)
+            prom.set_exception(std::make_exception_ptr(std::system_error(-res, std::generic_category(), what)));
+        else
+            prom.set_value(res);
+    }
+
+    // the number of requests handed to the backend, but not completed.
+    size_t started() const { return _inflight - _pending.size(); }
+
+    void startpending()
+    {
+#ifdef __linux__
+        if (_ring) {
+            bool any = false;
+            while (!_pending.empty() && started() < _queuedepth) {
+                auto sqe = _ring->getsqe();
+                if (!sqe)
+                    break;
+                auto r = _pending.front().release();
+                _pending.pop_front();
+
+                sqe->opcode = r->op==OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+                sqe->fd = r->f.empty() ? -1 : r->f.fh();
+                sqe->off = r->ofs;
+                sqe->addr = (uint64_t)r->ptr;
+                sqe->len = r->count;
+                sqe->user_data = (uint64_t)r;
+                _ring->advancesq();
+                any = true;
+            }
+            if (any)
+                _ring->enter(0);
+            return;
+        }
+#endif
+        bool any = false;
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            while (!_pending.empty() && started() < _queuedepth) {
+                _work.push_back(_pending.front().release());
+                _pending.pop_front();
+                any = true;
+            }
+        }
+        if (any)
+            _workcv.notify_all();
+    }
+
+    size_t complete()
+    {
+        std::vector<requestptr> done;
+#ifdef __linux__
+        if (_ring) {
+            _ring->reap([&done](uint64_t userdata, int32_t res) {
+                requestptr r((request*)userdata);
+                r->result = res;
+                done.push_back(std::move(r));
+            });
+        }
+        else
+#endif
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            for (auto r : _done)
+                done.emplace_back(r);
+            _done.clear();
+        }
+        _inflight -= done.size();
+        std::exception_ptr error;
+        for (auto& r : done) {
+            try {
+                if (r->cb)
+                    r->cb(r->result);
+            }
+            catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+        return done.size();
+    }
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (true) {
+            _workcv.wait(lock, [this]() { return _stopping || !_work.empty(); });
+            if (_work.empty())
+                return;
+            auto r = _work.front();
+            _work.pop_front();
+
+            lock.unlock();
+            try {
+                if (r->op == OP_READ)
+                    r->result = r->f.pread(r->ofs, (uint8_t*)r->ptr, r->count);
+                else
+                    r->result = r->f.pwrite(r->ofs, (const uint8_t*)r->ptr, r->count);
+            }
+            catch (const std::system_error& e) {
+                r->result = -e.code().value();
+            }
+            catch (...) {
+                r->result = -EBADF;
+            }
+            lock.lock();
+
+            _done.push_back(r);
+            _donecv.notify_all();
+        }
+    }
+};
@@ -0,0 +1,340 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <span>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include <cpputils/fhandle.h>
+#include <cpputils/datapacking.h>
+#include <cpputils/formatter.h>
+
+/*
+ * Buffered reading and writing on a filehandle, so many small reads or writes
+ * don't each cost a syscall.
+ *
+ *   bufferedreader r(filehandle("file.bin"));
+ *   unpacker u(r.begin(), r.end());
+ *   auto magic = u.get32le();
+ *
+ *   std::string line;
+ *   while (r.readline(line))
+ *       ...
+ *
+ * Note that both classes maintain their own file position, don't mix these
+ * with unbuffered reads or writes on the same filehandle.
+ */
+struct bufferedreader {
+    filehandle _f;
+    std::vector<uint8_t> _buf;
+    size_t _pos = 0;    // unread data is in _buf[_pos, _end)
+    size_t _end = 0;
+    uint64_t _fileofs = 0;  // file offset of _buf[_pos]
+
+    bufferedreader(filehandle f, size_t bufsize = 0x10000)
+        : _f(f), _buf(std::max(bufsize, size_t(16)))
+    {
+    }
+
+    // the number of buffered bytes
+    size_t available() const { return _end - _pos; }
+
+    // returns the file offset of the next byte to be read.
+    uint64_t tell() const { return _fileofs; }
+
+    // make sure at least n bytes are buffered, growing the buffer when needed.
+    // returns the number of available bytes, which is less than n only at EOF.
+    size_t fill(size_t n)
+    {
+        if (available() >= n)
+            return available();
+        if (_pos + n > _buf.size()) {
+            std::copy(_buf.begin()+_pos, _buf.begin()+_end, _buf.begin());
+            _end -= _pos;
+            _pos = 0;
+            if (n > _buf.size())
+                _buf.resize(n);
+        }
+        while (available() < n) {
+            size_t r = _f.read(_buf.data()+_end, _buf.size()-_end);
+            if (r == 0)
+                break;
+            _end += r;
+        }
+        return available();
+    }
+    bool eof() { return fill(1) == 0; }
+
+    // returns up to n bytes, without consuming them.
+    // The span is valid until the next read.
+    std::span<const uint8_t> peek(size_t n)
+    {
+        n = std::min(n, fill(n));
+        return { _buf.data()+_pos, n };
+    }
+
+    void skip(size_t n)
+    {
+        if (fill(std::min(n, _buf.size())) < std::min(n, _buf.size()))
+            throw std::runtime_error("eof");
+        if (n > available()) {
+            // skip more than the buffer contains.
+            size_t remaining = n - available();
+            consume(available());
+            while (remaining) {
+                size_t chunk = std::min(remaining, fill(std::min(remaining, _buf.size())));
+                if (chunk == 0)
+                    throw std::runtime_error("eof");
+                consume(chunk);
+                remaining -= chunk;
+            }
+            return;
+        }
+        consume(n);
+    }
+
+    // read upto count bytes, returns the number of bytes read, 0 at EOF.
+    // large reads bypass the buffer.
+    size_t read(uint8_t *ptr, size_t count)
+    {
+        if (available() == 0 && count >= _buf.size()) {
+            size_t r = _f.read(ptr, count);
+            _fileofs += r;
+            return r;
+        }
+        size_t n = std::min(count, fill(std::min(count, _buf.size())));
+        std::memcpy(ptr, _buf.data()+_pos, n);
+        consume(n);
+        return n;
+    }
+
+    // read exactly count bytes, throws when EOF is reached first.
+    void read_exact(uint8_t *ptr, size_t count)
+    {
+        while (count) {
+            size_t n = read(ptr, count);
+            if (n == 0)
+                throw std::runtime_error("eof");
+            ptr += n;
+            count -= n;
+        }
+    }
+    std::vector<uint8_t> read_exact(size_t count)
+    {
+        std::vector<uint8_t> data(count);
+        read_exact(data.data(), count);
+        return data;
+    }
+
+    // read a line, without the terminating LF.
+    // returns false when at EOF.
+    bool readline(std::string& line)
+    {
+        line.clear();
+        while (fill(1)) {
+            auto first = _buf.begin()+_pos;
+            auto last = _buf.begin()+_end;
+            auto lf = std::find(first, last, '\n');
+            line.append(first, lf);
+            if (lf != last) {
+                consume(lf - first + 1);
+                return true;
+            }
+            consume(last - first);
+        }
+        return !line.empty();
+    }
+
+    // returns an unpacker for the next n bytes, and consumes them.
+    // The unpacker is valid until the next read.
+    unpacker<const uint8_t*> getunpacker(size_t n)
+    {
+        if (fill(n) < n)
+            throw std::runtime_error("eof");
+        const uint8_t *p = _buf.data()+_pos;
+        consume(n);
+        return unpacker<const uint8_t*>(p, p+n);
+    }
+
+    /*
+     * input iterator over the bytes of the file.
+     *
+     * Can be used with `unpacker` for the `getNN` and `skip` methods.
+     * Since there is no difference operator, the unpacker does not check sizes,
+     * instead, reading past EOF throws from the iterator.
+     */
+    struct iterator {
+        using iterator_category = std::input_iterator_tag;
+        using value_type = uint8_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint8_t*;
+        using reference = uint8_t;
+
+        bufferedreader *r = nullptr;  // nullptr for the end iterator
+
+        // result of post-increment
+        struct proxy {
+            uint8_t value;
+            uint8_t operator*() const { return value; }
+        };
+
+        uint8_t operator*() const
+        {
+            if (r->fill(1) == 0)
+                throw std::runtime_error("eof");
+            return r->_buf[r->_pos];
+        }
+        iterator& operator++()
+        {
+            r->skip(1);
+            return *this;
+        }
+        proxy operator++(int)
+        {
+            proxy p{**this};
+            ++*this;
+            return p;
+        }
+        iterator& operator+=(size_t n)
+        {
+            r->skip(n);
+            return *this;
+        }
+        bool atend() const { return r==nullptr || r->eof(); }
+        friend bool operator==(const iterator& lhs, const iterator& rhs)
+        {
+            if (lhs.r && rhs.r)
+                return lhs.r == rhs.r;
+            return lhs.atend() && rhs.atend();
+        }
+        friend bool operator!=(const iterator& lhs, const iterator& rhs)
+        {
+            return !(lhs == rhs);
+        }
+    };
+    iterator begin() { return iterator{this}; }
+    iterator end() { return iterator{}; }
+
+private:
+    void consume(size_t n)
+    {
+        _pos += n;
+        _fileofs += n;
+        if (_pos == _end)
+            _pos = _end = 0;
+    }
+};
+
+/*
+ * Buffered writing to a filehandle.
+ *
+ * The destructor flushes the buffer, but ignores errors,
+ * call `flush` explicitly to be notified of write errors.
+ *
+ *   bufferedwriter w(f);
+ *   packer p(w.inserter(), w.inserter());
+ *   p.set32le(123);
+ *   fprint(w, "%d\n", 123);
+ *   w.flush();
+ */
+struct bufferedwriter {
+    filehandle _f;
+    std::vector<uint8_t> _buf;
+    size_t _used = 0;
+
+    bufferedwriter(filehandle f, size_t bufsize = 0x10000)
+        : _f(f), _buf(std::max(bufsize, size_t(16)))
+    {
+    }
+    bufferedwriter(const bufferedwriter&) = delete;
+    ~bufferedwriter()
+    {
+        try {
+            flush();
+        }
+        catch (...) {
+        }
+    }
+
+    // the number of bytes waiting to be written.
+    size_t buffered() const { return _used; }
+
+    void write(const uint8_t *ptr, size_t count)
+    {
+        if (_used + count > _buf.size()) {
+            flush();
+            if (count >= _buf.size()) {
+                writeall(ptr, count);
+                return;
+            }
+        }
+        std::memcpy(_buf.data()+_used, ptr, count);
+        _used += count;
+    }
+    void write(const char *ptr, size_t count) { write((const uint8_t*)ptr, count); }
+    template<typename RANGE>
+    void write(const RANGE& r)
+    {
+        write((const uint8_t*)std::data(r), std::size(r)*sizeof(*std::data(r)));
+    }
+    void put(uint8_t byte)
+    {
+        if (_used == _buf.size())
+            flush();
+        _buf[_used++] = byte;
+    }
+
+    // when writing fails, the unwritten data stays in the buffer.
+    void flush()
+    {
+        size_t done = 0;
+        try {
+            while (done < _used)
+                done += _f.write(_buf.data()+done, _used-done);
+        }
+        catch (...) {
+            std::memmove(_buf.data(), _buf.data()+done, _used-done);
+            _used -= done;
+            throw;
+        }
+        _used = 0;
+    }
+
+    // output iterator, for use with `packer`.
+    struct insert_iterator {
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        bufferedwriter *w;
+
+        insert_iterator& operator=(uint8_t byte) { w->put(byte); return *this; }
+        insert_iterator& operator*() { return *this; }
+        insert_iterator& operator++() { return *this; }
+        insert_iterator operator++(int) { return *this; }
+    };
+    insert_iterator inserter() { return insert_iterator{this}; }
+
+private:
+    void writeall(const uint8_t *ptr, size_t count)
+    {
+        while (count) {
+            size_t n = _f.write(ptr, count);
+            ptr += n;
+            count -= n;
+        }
+    }
+};
+
+template<typename...ARGS>
+int fprint(bufferedwriter& out, const char *fmt, ARGS&&...args)
+{
+    auto str = stringformat(fmt, std::forward<ARGS>(args)...);
+    out.write(str.c_str(), str.size());
+    return str.size();
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <array>
 #include <cstdint>
+#include <cstddef>
 
 template<typename INT, INT poly, int nbits>
 class CrcCalc {
@@ -36,14 +37,14 @@ public:
     {
         return table[(crc^b)&0xFF] ^ (crc>>8);
     }
-    INT add(INT crc, const uint8_t *p, int size) const
+    INT add(INT crc, const uint8_t *p, size_t size) const
     {
         while (size--)
             crc = add(crc, *p++);
         return crc;
     }
 
-    INT calc(const uint8_t *p, int size) const
+    INT calc(const uint8_t *p, size_t size) const
     {
         constexpr INT mask = ((((INT)1<<(nbits-1))-1)<<1) | 1;
         return add(mask, p, size) ^ mask;
@@ -85,3 +86,22 @@ uint32_t crc32(const V& v)
 {
     return crc32(&v[0], v.size());
 } 
+
+
+// crc-64/xz, the ECMA-182 polynomial, reflected.
+template<typename P>
+uint64_t crc64(uint64_t crc, P ptr, size_t size)
+{
+    static CrcCalc<uint64_t, 0xC96C5795D7870F42, 64> CRC;
+    return CRC.add(crc, ptr, size);
+}
+template<typename P>
+uint64_t crc64(P ptr, size_t size)
+{
+    return crc64(~uint64_t(0), ptr, size) ^ ~uint64_t(0);
+}
+template<typename V>
+uint64_t crc64(const V& v)
+{
+    return crc64(&v[0], v.size());
+}
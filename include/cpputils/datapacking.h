@@ -5,6 +5,12 @@
 #include <string>
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
+#if __cplusplus > 201703L
+#include <bit>
+#include <iterator>
+#include <span>
+#endif
 
 #include <cpputils/templateutils.h>
 
@@ -21,6 +27,58 @@ constexpr bool has_op_difference_v<
 > = true;
 
 
+template<typename INT>
+constexpr INT byteswapped(INT value)
+{
+    INT result = 0;
+    for (size_t i = 0 ; i < sizeof(INT) ; i++) {
+        result = (result<<8) | (value&0xFF);
+        value >>= 8;
+    }
+    return result;
+}
+
+#if __cplusplus > 201703L
+// true when P points to contiguous bytes, so multibyte values can be
+// accessed with a single load or store.
+template<typename P>
+constexpr bool is_contiguous_bytes_v = false;
+template<std::contiguous_iterator P>
+constexpr bool is_contiguous_bytes_v<P> = sizeof(std::iter_value_t<P>)==1;
+
+template<typename P>
+uint64_t loadle64(P p)
+{
+    uint64_t value;
+    std::memcpy(&value, &*p, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big)
+        value = byteswapped(value);
+    return value;
+}
+#endif
+
+// zigzag maps signed integers to unsigned: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+// so small negative numbers result in short varints.
+inline uint64_t zigzag_encode(int64_t value)
+{
+    return (uint64_t(value)<<1) ^ uint64_t(value>>63);
+}
+inline int64_t zigzag_decode(uint64_t value)
+{
+    return int64_t(value>>1) ^ -int64_t(value&1);
+}
+
+// the number of bytes needed for the LEB128 encoding of value.
+inline int varint_size(uint64_t value)
+{
+    int n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
 template<typename P>
 struct packer_base {
     P p;
@@ -103,7 +161,7 @@ struct unchecked_unpacker : packer_base<P> {
     {
         uint8_t hi = get8();
         uint16_t lo = get16be();
-        return (uint32_t(hi)<<8) | lo;
+        return (uint32_t(hi)<<16) | lo;
     }
     uint32_t get32be()
     {
@@ -128,6 +186,63 @@ struct unchecked_unpacker : packer_base<P> {
     std::vector<uint8_t> getbytes(int n) { this->p += n; return std::vector<uint8_t>(this->p-n, this->p); }
 
     const uint8_t *getdata(int n) { this->p += n; return &*(this->p-n); }
+
+    // LEB128 encoded unsigned integer.
+    uint64_t getvarint()
+    {
+        uint64_t value;
+        if (getvarint8(value))
+            return value;
+        value = 0;
+        for (int shift = 0 ; ; shift += 7) {
+            if (shift > 63)
+                throw std::runtime_error("varint too long");
+            uint8_t b = get8();
+            value |= uint64_t(b&0x7F) << shift;
+            if ((b&0x80)==0)
+                return value;
+        }
+    }
+    // zigzag + LEB128 encoded signed integer.
+    int64_t getsvarint() { return zigzag_decode(getvarint()); }
+
+    template<typename OUT>
+    OUT getvarints(OUT out, size_t count)
+    {
+        while (count--)
+            *out++ = getvarint();
+        return out;
+    }
+protected:
+    // fast path: decodes a varint of at most 8 bytes with a single load.
+    // returns false, without consuming anything, when this is not possible.
+    bool getvarint8(uint64_t& value)
+    {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>) {
+            if (!this->have(8))
+                return false;
+            uint64_t w = loadle64(this->p);
+            uint64_t stops = ~w & 0x8080808080808080ULL;
+            if (stops == 0)
+                return false;
+
+            // keep all bytes upto and including the first byte without continuation bit.
+            w &= stops ^ (stops-1);
+            w &= 0x7F7F7F7F7F7F7F7FULL;
+
+            // squeeze out the continuation bits.
+            w = (w & 0x007F007F007F007FULL) | ((w & 0x7F007F007F007F00ULL) >> 1);
+            w = (w & 0x00003FFF00003FFFULL) | ((w & 0x3FFF00003FFF0000ULL) >> 2);
+            w = (w & 0x000000000FFFFFFFULL) | ((w & 0x0FFFFFFF00000000ULL) >> 4);
+
+            this->p += (std::countr_zero(stops)>>3) + 1;
+            value = w;
+            return true;
+        }
+#endif
+        return false;
+    }
 };
 template<typename P>
 struct unpacker : unchecked_unpacker<P> {
@@ -158,6 +273,49 @@ struct unpacker : unchecked_unpacker<P> {
     std::vector<uint8_t> getbytes(int n) { this->require(n); return unchecked_unpacker<P>::getbytes(n); }
 
     const uint8_t *getdata(int n) { this->require(n); return unchecked_unpacker<P>::getdata(n); }
+
+    uint64_t getvarint()
+    {
+        uint64_t value;
+        if (this->getvarint8(value))
+            return value;
+        value = 0;
+        for (int shift = 0 ; ; shift += 7) {
+            if (shift > 63)
+                throw std::runtime_error("varint too long");
+            uint8_t b = get8();
+            value |= uint64_t(b&0x7F) << shift;
+            if ((b&0x80)==0)
+                return value;
+        }
+    }
+    int64_t getsvarint() { return zigzag_decode(getvarint()); }
+
+    // decode `count` varints into `out`.
+    // runs of 8 single byte varints are decoded with a single load.
+    template<typename OUT>
+    OUT getvarints(OUT out, size_t count)
+    {
+        while (count) {
+#if __cplusplus > 201703L
+            if constexpr (is_contiguous_bytes_v<P>) {
+                if (count >= 8 && this->have(8)) {
+                    uint64_t w = loadle64(this->p);
+                    if ((w & 0x8080808080808080ULL) == 0) {
+                        for (int i = 0 ; i < 8 ; i++)
+                            *out++ = uint8_t(w>>(8*i));
+                        this->p += 8;
+                        count -= 8;
+                        continue;
+                    }
+                }
+            }
+#endif
+            *out++ = getvarint();
+            count--;
+        }
+        return out;
+    }
 };
 template<typename CONTAINER, typename dummy = std::enable_if_t<is_container_v<CONTAINER> > >
 auto makeunpacker(CONTAINER& v)
@@ -183,6 +341,10 @@ struct unchecked_packer : packer_base<P> {
     }
     void set16le(uint16_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::little>(value);
+#endif
         set8(value);
         set8(value>>8);
     }
@@ -193,16 +355,28 @@ struct unchecked_packer : packer_base<P> {
     }
     void set32le(uint32_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::little>(value);
+#endif
         set16le(value);
         set16le(value>>16);
     }
     void set64le(uint64_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::little>(value);
+#endif
         set32le(value);
         set32le(value>>32);
     }
     void set16be(uint16_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::big>(value);
+#endif
         set8(value>>8);
         set8(value);
     }
@@ -213,21 +387,52 @@ struct unchecked_packer : packer_base<P> {
     }
     void set32be(uint32_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::big>(value);
+#endif
         set16be(value>>16);
         set16be(value);
     }
     void set64be(uint64_t value)
     {
+#if __cplusplus > 201703L
+        if constexpr (is_contiguous_bytes_v<P>)
+            return store<std::endian::big>(value);
+#endif
         set32be(value>>32);
         set32be(value);
     }
-    void setstr(const std::string& txt) { std::copy(txt.begin(), txt.end(), this->p); this->p += txt.size(); }
+    void setstr(const std::string& txt) { this->p = std::copy(txt.begin(), txt.end(), this->p); }
     void setzstr(const std::string& txt) { setstr(txt); set8(0); }
 
     template<typename CONTAINER, typename dummy = std::enable_if_t<is_container_v<CONTAINER> > >
-    void setbytes(const CONTAINER& data) { std::copy(data.begin(), data.end(), this->p); this->p += data.size(); }
+    void setbytes(const CONTAINER& data) { this->p = std::copy(data.begin(), data.end(), this->p); }
     template<typename Q>
-    void setbytes(Q first, Q last) { std::copy(first, last, this->p); this->p += std::distance(first, last); }
+    void setbytes(Q first, Q last) { this->p = std::copy(first, last, this->p); }
+
+    void setvarint(uint64_t value)
+    {
+        while (value >= 0x80) {
+            set8(value | 0x80);
+            value >>= 7;
+        }
+        set8(value);
+    }
+    void setsvarint(int64_t value) { setvarint(zigzag_encode(value)); }
+
+#if __cplusplus > 201703L
+protected:
+    // store value with a single write.
+    template<std::endian E, typename INT>
+    void store(INT value)
+    {
+        if constexpr (E != std::endian::native)
+            value = byteswapped(value);
+        std::memcpy(&*this->p, &value, sizeof(value));
+        this->p += sizeof(value);
+    }
+#endif
 };
 template<typename P>
 struct packer : unchecked_packer<P> {
@@ -254,6 +459,9 @@ struct packer : unchecked_packer<P> {
     template<typename Q>
     void setbytes(Q first, Q last) { this->require(std::distance(first, last)); unchecked_packer<P>::setbytes(first, last); }
 
+    void setvarint(uint64_t value) { this->require(varint_size(value)); unchecked_packer<P>::setvarint(value); }
+    void setsvarint(int64_t value) { setvarint(zigzag_encode(value)); }
+
 };
 template<typename CONTAINER, typename dummy = std::enable_if_t<is_container_v<CONTAINER> > >
 auto makepacker(CONTAINER& v)
@@ -266,6 +474,211 @@ auto makepacker(P first, P last)
     return packer(first, last);
 }
 
+/*
+ * packer appending to a std::vector<uint8_t>.
+ *
+ * Unlike `packer` with a back_insert_iterator, space is reserved ahead,
+ * growing the vector geometrically, and values are stored directly in the buffer.
+ *
+ * While packing, the vector may contain unused reserved bytes at the end,
+ * these are removed by `finish`, or when the packer is destroyed.
+ */
+struct vectorpacker : unchecked_packer<uint8_t*> {
+    std::vector<uint8_t>& v;
+    size_t start;    // offset in `v` where this packer started writing
+
+    vectorpacker(std::vector<uint8_t>& v, size_t reserve = 0)
+        : unchecked_packer<uint8_t*>(v.data()+v.size(), v.data()+v.size()), v(v), start(v.size())
+    {
+        if (reserve)
+            require(reserve);
+    }
+    vectorpacker(const vectorpacker&) = delete;
+    ~vectorpacker()
+    {
+        v.resize(position());
+    }
+
+    // the offset in `v` of the next byte to be written.
+    size_t position() const { return p - v.data(); }
+    // the number of bytes written by this packer.
+    size_t size() const { return position() - start; }
+
+    bool have(int n) { return n <= last-p; }
+    // make sure at least n more bytes can be written.
+    void require(int n)
+    {
+        if (have(n))
+            return;
+        size_t pos = position();
+        v.resize(std::max({ size_t(64), 2*v.size(), pos+n }));
+        p = v.data()+pos;
+        last = v.data()+v.size();
+    }
+
+    void set8(uint8_t value) { require(1); unchecked_packer::set8(value); }
+    void set16le(uint16_t value) { require(2); unchecked_packer::set16le(value); }
+    void set24le(uint32_t value) { require(3); unchecked_packer::set24le(value); }
+    void set32le(uint32_t value) { require(4); unchecked_packer::set32le(value); }
+    void set64le(uint64_t value) { require(8); unchecked_packer::set64le(value); }
+    void set16be(uint16_t value) { require(2); unchecked_packer::set16be(value); }
+    void set24be(uint32_t value) { require(3); unchecked_packer::set24be(value); }
+    void set32be(uint32_t value) { require(4); unchecked_packer::set32be(value); }
+    void set64be(uint64_t value) { require(8); unchecked_packer::set64be(value); }
+
+    void setstr(const std::string& txt) { require(txt.size()); unchecked_packer::setstr(txt); }
+    void setzstr(const std::string& txt) { require(txt.size()+1); unchecked_packer::setzstr(txt); }
+
+    template<typename CONTAINER, typename dummy = std::enable_if_t<is_container_v<CONTAINER> > >
+    void setbytes(const CONTAINER& data) { require(data.size()); unchecked_packer::setbytes(data); }
+    template<typename Q>
+    void setbytes(Q first, Q last) { require(std::distance(first, last)); unchecked_packer::setbytes(first, last); }
+
+    void setvarint(uint64_t value) { require(varint_size(value)); unchecked_packer::setvarint(value); }
+    void setsvarint(int64_t value) { setvarint(zigzag_encode(value)); }
+
+    // remove the reserved space from the vector.
+    void finish() { v.resize(position()); last = p; }
+
+#if __cplusplus > 201703L
+    // the bytes written by this packer.
+    std::span<uint8_t> span() { return { v.data()+start, size() }; }
+#endif
+};
+
+#if __cplusplus > 201703L
+/*
+ * vectorpacker which references payload data instead of copying it.
+ *
+ * `segments` returns the packed data interleaved with the payloads,
+ * to be written with `filehandle::writev`, or `writevall` which also handles partial writes:
+ *
+ *   std::vector<uint8_t> hdr;
+ *   segmentpacker p(hdr);
+ *   p.set32le(payload.size());
+ *   p.addpayload(payload);
+ *   p.set32le(crc);
+ *   f.writevall(p.segments());
+ *
+ * The payloads must stay valid until the segments have been written.
+ */
+struct segmentpacker : vectorpacker {
+    // payloads, with the position of the packed data they follow.
+    std::vector<std::pair<size_t, std::span<const uint8_t>>> payloads;
+
+    segmentpacker(std::vector<uint8_t>& v, size_t reserve = 0)
+        : vectorpacker(v, reserve)
+    {
+    }
+
+    void addpayload(std::span<const uint8_t> data)
+    {
+        payloads.emplace_back(position(), data);
+    }
+
+    // the total number of bytes, packed data plus payloads.
+    size_t totalsize() const
+    {
+        size_t total = size();
+        for (auto& [pos, data] : payloads)
+            total += data.size();
+        return total;
+    }
+
+    // note: the packed data spans are invalidated by further packing.
+    std::vector<std::span<const uint8_t>> segments() const
+    {
+        std::vector<std::span<const uint8_t>> segs;
+        size_t pos = start;
+        for (auto& [ofs, data] : payloads) {
+            if (pos < ofs)
+                segs.emplace_back(v.data()+pos, ofs-pos);
+            segs.push_back(data);
+            pos = ofs;
+        }
+        if (pos < position())
+            segs.emplace_back(v.data()+pos, position()-pos);
+        return segs;
+    }
+};
+#endif
+
+/*
+ * reading bitfields, most significant bit first.
+ *
+ * Only the bits of the current partial byte are buffered, so after `align()`
+ * `p` points to the next unread byte.
+ */
+template<typename P>
+struct bitunpacker : packer_base<P> {
+    uint64_t bits = 0;
+    int nbits = 0;    // nr of unread bits in `bits`
+
+    bitunpacker(P first, P last)
+        : packer_base<P>(first, last)
+    {
+    }
+
+    uint64_t getbits(int n)
+    {
+        if (n > 56) {
+            uint64_t hi = getbits(n-32);
+            return (hi<<32) | getbits(32);
+        }
+        while (nbits < n) {
+            this->require(1);
+            bits = (bits<<8) | uint8_t(*(this->p)++);
+            nbits += 8;
+        }
+        nbits -= n;
+        return (bits>>nbits) & ((uint64_t(1)<<n)-1);
+    }
+    bool getbit() { return getbits(1); }
+
+    // discard the remaining bits of the current byte.
+    void align() { nbits = 0; }
+};
+
+/*
+ * writing bitfields, most significant bit first.
+ *
+ * Complete bytes are written immediately, use `align()` to pad the
+ * last partial byte with zero bits.
+ */
+template<typename P>
+struct bitpacker : packer_base<P> {
+    uint64_t bits = 0;
+    int nbits = 0;    // nr of bits in `bits` not yet written
+
+    bitpacker(P first, P last)
+        : packer_base<P>(first, last)
+    {
+    }
+
+    void setbits(int n, uint64_t value)
+    {
+        if (n > 56) {
+            setbits(n-32, value>>32);
+            setbits(32, value);
+            return;
+        }
+        bits = (bits<<n) | (value & ((uint64_t(1)<<n)-1));
+        nbits += n;
+        while (nbits >= 8) {
+            this->require(1);
+            nbits -= 8;
+            *(this->p)++ = uint8_t(bits>>nbits);
+        }
+    }
+    void setbit(bool bit) { setbits(1, bit); }
+
+    void align()
+    {
+        if (nbits)
+            setbits(8-nbits, 0);
+    }
+};
+
 /*
  *  unchecked packer
  */
@@ -294,6 +707,8 @@ template<typename P>
     static std::string getzstr(P p) { return unchecked_unpacker<P>(p, p).getzstr(); }
 template<typename P>                                                      
     static std::vector<uint8_t> getbytes(P p, size_t n) { return unchecked_unpacker<P>(p, p).getbytes(n); }
+template<typename P>
+    static uint64_t getvarint(P p) { return unchecked_unpacker<P>(p, p).getvarint(); }
 template<typename P>
     static void set8(P p, uint8_t x) { unchecked_packer<P>(p, p).set8(x); }
 template<typename P>
@@ -318,5 +733,7 @@ template<typename P>
     static void setzstr(P p, const std::string& txt) { unchecked_packer<P>(p, p).setzstr(txt); }
 template<typename P, typename CONTAINER, typename dummy = std::enable_if_t<is_container_v<CONTAINER> > >
     static void setbytes(P p, const CONTAINER& data) { unchecked_packer<P>(p, p).setbytes(data); }
+template<typename P>
+    static void setvarint(P p, uint64_t x) { unchecked_packer<P>(p, p).setvarint(x); }
 
 };
@@ -0,0 +1,398 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <array>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <type_traits>
+
+#include <cpputils/datapacking.h>
+
+/*
+ * Declarative description of binary records, on top of the packer/unpacker
+ * classes from datapacking.h.
+ *
+ * Usage:
+ *
+ *   struct header {
+ *       uint32_t magic;
+ *       uint16_t version;
+ *       std::string name;
+ *       std::vector<uint32_t> offsets;
+ *   };
+ *   using header_layout = record::layout<header,
+ *       record::field<&header::magic,   record::le<4>>,
+ *       record::field<&header::version, record::be<2>>,
+ *       record::pad<2>,
+ *       record::field<&header::name,    record::fixedstr<16>>,
+ *       record::field<&header::offsets, record::counted<record::le<2>, record::le<4>>>
+ *   >;
+ *
+ *   auto u = makeunpacker(data);
+ *   header h = header_layout::get(u);
+ *
+ *   auto p = makepacker(buf);
+ *   header_layout::put(p, h);
+ *
+ * A record with only fixed size fields has a constexpr `fixedsize`, these
+ * can be decoded in bulk into one vector per field using `getcolumns`.
+ *
+ * Each coding provides:
+ *   - fixedsize            - the encoded size, or `record::variable`.
+ *   - get(unpacker, value) - decode into value.
+ *   - put(packer, value)   - encode value.
+ *   - encodedsize(value)   - the number of bytes `put` will write.
+ */
+namespace record {
+
+constexpr size_t variable = ~size_t(0);
+
+// check that `count` items of `size` bytes are available.
+// unpacker::require takes an int, so large counts are rejected before multiplying.
+template<typename U>
+void requireitems(U& u, size_t count, size_t size)
+{
+    if (size && count > size_t(std::numeric_limits<int>::max())/size)
+        throw std::runtime_error("not enough data");
+    u.require(int(count*size));
+}
+
+template<typename M>
+struct member_traits;
+template<typename C, typename V>
+struct member_traits<V C::*> {
+    using class_type = C;
+    using value_type = V;
+};
+
+// little endian unsigned integer of N bytes
+template<int N>
+struct le {
+    static_assert(N==1 || N==2 || N==3 || N==4 || N==8, "unsupported integer size");
+    static constexpr size_t fixedsize = N;
+
+    template<typename U>
+    static auto decode(U& u)
+    {
+        if constexpr (N==1) return u.get8();
+        else if constexpr (N==2) return u.get16le();
+        else if constexpr (N==3) return u.get24le();
+        else if constexpr (N==4) return u.get32le();
+        else return u.get64le();
+    }
+    template<typename P>
+    static void encode(P& p, uint64_t value)
+    {
+        if constexpr (N==1) p.set8(value);
+        else if constexpr (N==2) p.set16le(value);
+        else if constexpr (N==3) p.set24le(value);
+        else if constexpr (N==4) p.set32le(value);
+        else p.set64le(value);
+    }
+
+    template<typename U, typename V>
+    static void get(U& u, V& value) { value = static_cast<V>(decode(u)); }
+    template<typename P, typename V>
+    static void put(P& p, const V& value) { encode(p, static_cast<uint64_t>(value)); }
+    template<typename V>
+    static size_t encodedsize(const V&) { return N; }
+};
+
+// big endian unsigned integer of N bytes
+template<int N>
+struct be {
+    static_assert(N==1 || N==2 || N==3 || N==4 || N==8, "unsupported integer size");
+    static constexpr size_t fixedsize = N;
+
+    template<typename U>
+    static auto decode(U& u)
+    {
+        if constexpr (N==1) return u.get8();
+        else if constexpr (N==2) return u.get16be();
+        else if constexpr (N==3) return u.get24be();
+        else if constexpr (N==4) return u.get32be();
+        else return u.get64be();
+    }
+    template<typename P>
+    static void encode(P& p, uint64_t value)
+    {
+        if constexpr (N==1) p.set8(value);
+        else if constexpr (N==2) p.set16be(value);
+        else if constexpr (N==3) p.set24be(value);
+        else if constexpr (N==4) p.set32be(value);
+        else p.set64be(value);
+    }
+
+    template<typename U, typename V>
+    static void get(U& u, V& value) { value = static_cast<V>(decode(u)); }
+    template<typename P, typename V>
+    static void put(P& p, const V& value) { encode(p, static_cast<uint64_t>(value)); }
+    template<typename V>
+    static size_t encodedsize(const V&) { return N; }
+};
+
+// string stored in exactly N bytes, padded with NUL.
+// trailing NULs are stripped when decoding.
+template<int N>
+struct fixedstr {
+    static constexpr size_t fixedsize = N;
+
+    template<typename U>
+    static void get(U& u, std::string& value)
+    {
+        value = u.getstr(N);
+        value.erase(std::find(value.begin(), value.end(), 0), value.end());
+    }
+    template<typename P>
+    static void put(P& p, const std::string& value)
+    {
+        if (value.size() > N)
+            throw std::runtime_error("string too long for fixedstr");
+        p.setstr(value);
+        for (size_t i = value.size() ; i < N ; i++)
+            p.set8(0);
+    }
+    static size_t encodedsize(const std::string&) { return N; }
+};
+
+// NUL terminated string
+struct zstr {
+    static constexpr size_t fixedsize = variable;
+
+    template<typename U>
+    static void get(U& u, std::string& value) { value = u.getzstr(); }
+    template<typename P>
+    static void put(P& p, const std::string& value) { p.setzstr(value); }
+    static size_t encodedsize(const std::string& value) { return value.size()+1; }
+};
+
+// string prefixed with a byte count, encoded using COUNT
+template<typename COUNT>
+struct lenstr {
+    static constexpr size_t fixedsize = variable;
+
+    template<typename U>
+    static void get(U& u, std::string& value)
+    {
+        size_t n = COUNT::decode(u);
+        requireitems(u, n, 1);
+        value = u.getstr(n);
+    }
+    template<typename P>
+    static void put(P& p, const std::string& value)
+    {
+        COUNT::encode(p, value.size());
+        p.setstr(value);
+    }
+    static size_t encodedsize(const std::string& value) { return COUNT::fixedsize + value.size(); }
+};
+
+// array of elements, prefixed with an element count, encoded using COUNT
+template<typename COUNT, typename ELEM>
+struct counted {
+    static constexpr size_t fixedsize = variable;
+
+    template<typename U, typename V>
+    static void get(U& u, std::vector<V>& value)
+    {
+        size_t n = COUNT::decode(u);
+        if constexpr (ELEM::fixedsize != variable)
+            requireitems(u, n, ELEM::fixedsize);
+        value.resize(n);
+        for (auto& v : value)
+            ELEM::get(u, v);
+    }
+    template<typename P, typename V>
+    static void put(P& p, const std::vector<V>& value)
+    {
+        COUNT::encode(p, value.size());
+        for (auto& v : value)
+            ELEM::put(p, v);
+    }
+    template<typename V>
+    static size_t encodedsize(const std::vector<V>& value)
+    {
+        size_t total = COUNT::fixedsize;
+        for (auto& v : value)
+            total += ELEM::encodedsize(v);
+        return total;
+    }
+};
+
+// array of exactly N elements, stored in either a std::array or std::vector.
+template<int N, typename ELEM>
+struct fixedarray {
+    static constexpr size_t fixedsize = ELEM::fixedsize==variable ? variable : N*ELEM::fixedsize;
+
+    template<typename U, typename V>
+    static void get(U& u, std::vector<V>& value)
+    {
+        value.resize(N);
+        for (auto& v : value)
+            ELEM::get(u, v);
+    }
+    template<typename U, typename V>
+    static void get(U& u, std::array<V, N>& value)
+    {
+        for (auto& v : value)
+            ELEM::get(u, v);
+    }
+    template<typename P, typename A>
+    static void put(P& p, const A& value)
+    {
+        if (value.size() != N)
+            throw std::runtime_error("fixedarray size mismatch");
+        for (auto& v : value)
+            ELEM::put(p, v);
+    }
+    template<typename A>
+    static size_t encodedsize(const A& value)
+    {
+        size_t total = 0;
+        for (auto& v : value)
+            total += ELEM::encodedsize(v);
+        return total;
+    }
+};
+
+// binds a struct member to a coding.
+template<auto MEMBER, typename CODING>
+struct field {
+    using coding = CODING;
+    using value_type = typename member_traits<decltype(MEMBER)>::value_type;
+    static constexpr size_t fixedsize = CODING::fixedsize;
+
+    template<typename U, typename T>
+    static void get(U& u, T& obj) { CODING::get(u, obj.*MEMBER); }
+    template<typename P, typename T>
+    static void put(P& p, const T& obj) { CODING::put(p, obj.*MEMBER); }
+    template<typename T>
+    static size_t encodedsize(const T& obj) { return CODING::encodedsize(obj.*MEMBER); }
+
+    template<typename T>
+    static value_type& ref(T& obj) { return obj.*MEMBER; }
+};
+
+// N unused bytes, skipped when decoding, written as zero.
+template<int N>
+struct pad {
+    using coding = pad;
+    using value_type = void;
+    static constexpr size_t fixedsize = N;
+
+    template<typename U, typename T>
+    static void get(U& u, T&) { u.skip(N); }
+    template<typename P, typename T>
+    static void put(P& p, const T&) { for (int i = 0 ; i < N ; i++) p.set8(0); }
+    template<typename T>
+    static size_t encodedsize(const T&) { return N; }
+};
+
+// placeholder column for fields without a value, like `pad`.
+struct nocolumn {
+    void resize(size_t) { }
+};
+template<typename FIELD>
+using column_t = std::conditional_t<std::is_void_v<typename FIELD::value_type>, nocolumn, std::vector<typename FIELD::value_type>>;
+
+/*
+ * describes how struct T is encoded, as a sequence of fields.
+ *
+ * A layout can itself be used as the element coding of `counted` or `fixedarray`,
+ * for nested records.
+ */
+template<typename T, typename...FIELDS>
+struct layout {
+    static constexpr size_t fixedsize = ((FIELDS::fixedsize==variable) || ...) ? variable : (FIELDS::fixedsize + ... + 0);
+
+    // the offset of each field, only meaningful for the fixed size prefix of a record.
+    static constexpr std::array<size_t, sizeof...(FIELDS)> offsets = []() {
+        std::array<size_t, sizeof...(FIELDS)> ofs{};
+        size_t sizes[] = { FIELDS::fixedsize..., 0 };
+        size_t total = 0;
+        for (size_t i = 0 ; i < sizeof...(FIELDS) ; i++) {
+            ofs[i] = total;
+            total = (total==variable || sizes[i]==variable) ? variable : total+sizes[i];
+        }
+        return ofs;
+    }();
+
+    // one vector per field, see `getcolumns`
+    using columns = std::tuple<column_t<FIELDS>...>;
+
+    template<typename U>
+    static void get(U& u, T& obj) { (FIELDS::get(u, obj), ...); }
+    template<typename U>
+    static T get(U& u)
+    {
+        T obj{};
+        get(u, obj);
+        return obj;
+    }
+    template<typename P>
+    static void put(P& p, const T& obj) { (FIELDS::put(p, obj), ...); }
+
+    // returns the number of bytes needed to encode `obj`
+    static size_t encodedsize(const T& obj)
+    {
+        if constexpr (fixedsize != variable)
+            return fixedsize;
+        else
+            return (FIELDS::encodedsize(obj) + ... + 0);
+    }
+
+    // decode `count` consecutive records, returning a vector of T.
+    template<typename U>
+    static std::vector<T> getarray(U& u, size_t count)
+    {
+        if constexpr (fixedsize != variable)
+            requireitems(u, count, fixedsize);
+        std::vector<T> v(count);
+        for (auto& obj : v)
+            get(u, obj);
+        return v;
+    }
+
+    /*
+     * decode `count` consecutive fixed size records into a struct-of-arrays:
+     * a tuple with one vector per field, in field order.
+     *
+     * Each column is decoded in a separate strided pass over the input,
+     * so the resulting vectors are contiguous, and suitable for vectorized processing.
+     */
+    template<typename U>
+    static columns getcolumns(U& u, size_t count)
+    {
+        static_assert(fixedsize != variable, "getcolumns requires a fixed size record");
+        requireitems(u, count, fixedsize);
+
+        columns cols;
+        getcolumns(u.p, count, cols, std::index_sequence_for<FIELDS...>{});
+        u.p += count*fixedsize;
+
+        return cols;
+    }
+private:
+    template<typename P, size_t...IX>
+    static void getcolumns(P first, size_t count, columns& cols, std::index_sequence<IX...>)
+    {
+        (getcolumn<FIELDS>(first + offsets[IX], count, std::get<IX>(cols)), ...);
+    }
+    template<typename FIELD, typename P, typename COLUMN>
+    static void getcolumn(P first, size_t count, COLUMN& col)
+    {
+        if constexpr (!std::is_same_v<COLUMN, nocolumn>) {
+            col.resize(count);
+            for (size_t i = 0 ; i < count ; i++) {
+                unchecked_unpacker<P> u(first + i*fixedsize, first + (i+1)*fixedsize);
+                FIELD::coding::get(u, col[i]);
+            }
+        }
+    }
+};
+
+}  // namespace record
@@ -0,0 +1,358 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <span>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cpputils/fhandle.h>
+
+/*
+ * Unbuffered I/O, bypassing the page cache.
+ *
+ * On linux files are opened with O_DIRECT, on macos F_NOCACHE is set.
+ *
+ * O_DIRECT requires file offsets, transfer sizes and memory buffers to be
+ * aligned to the device's logical block size. `directfile` takes care of this:
+ * aligned requests go directly to the device, unaligned heads and tails are
+ * transferred through block aligned bounce buffers from an `alignedpool`.
+ *
+ *   directfile f("/dev/sdb");
+ *   auto buf = f.pool().get();
+ *   f.pread(0, buf.data(), buf.size());
+ *
+ * Note that unaligned writes do a read-modify-write of the partial blocks,
+ * concurrent unaligned writes to the same block are not safe.
+ */
+
+// a block of memory with a specified alignment.
+struct alignedbuffer {
+    struct deleter {
+        void operator()(uint8_t *p) { ::free(p); }
+    };
+    std::unique_ptr<uint8_t, deleter> _ptr;
+    size_t _size = 0;
+
+    alignedbuffer() { }
+    alignedbuffer(size_t size, size_t alignment)
+        : _size(size)
+    {
+        void *p = nullptr;
+        int rc = ::posix_memalign(&p, std::max(alignment, sizeof(void*)), size);
+        if (rc)
+            throw std::system_error(rc, std::generic_category(), "posix_memalign");
+        _ptr.reset((uint8_t*)p);
+    }
+
+    uint8_t *data() const { return _ptr.get(); }
+    size_t size() const { return _size; }
+    uint8_t *begin() const { return data(); }
+    uint8_t *end() const { return data() + size(); }
+    uint8_t& operator[](size_t i) const { return data()[i]; }
+    std::span<uint8_t> span() const { return { data(), size() }; }
+};
+
+/*
+ * a pool of equally sized aligned buffers.
+ *
+ * `get` returns a buffer which is returned to the pool when it goes out of scope.
+ * The pool keeps at most `maxfree` unused buffers. The pool must outlive its buffers.
+ * `get` and buffer release are thread safe.
+ */
+class alignedpool {
+    size_t _bufsize;
+    size_t _alignment;
+    size_t _maxfree;
+    std::mutex _mtx;
+    std::vector<alignedbuffer> _free;
+
+public:
+    // a buffer borrowed from the pool.
+    class buffer {
+        alignedpool *_pool = nullptr;
+        alignedbuffer _buf;
+    public:
+        buffer() { }
+        buffer(alignedpool *pool, alignedbuffer&& buf)
+            : _pool(pool), _buf(std::move(buf))
+        {
+        }
+        buffer(buffer&& b) = default;
+        buffer& operator=(buffer&& b)
+        {
+            release();
+            _pool = b._pool;
+            _buf = std::move(b._buf);
+            b._pool = nullptr;
+            return *this;
+        }
+        ~buffer() { release(); }
+
+        uint8_t *data() const { return _buf.data(); }
+        size_t size() const { return _buf.size(); }
+        uint8_t *begin() const { return data(); }
+        uint8_t *end() const { return data() + size(); }
+        uint8_t& operator[](size_t i) const { return data()[i]; }
+        std::span<uint8_t> span() const { return _buf.span(); }
+
+        void release()
+        {
+            if (_pool && _buf.data())
+                _pool->put(std::move(_buf));
+            _pool = nullptr;
+        }
+    };
+
+    alignedpool(size_t bufsize, size_t alignment, size_t maxfree = 16)
+        : _bufsize(bufsize), _alignment(alignment), _maxfree(maxfree)
+    {
+        if (alignment & (alignment-1))
+            throw std::runtime_error("alignedpool: alignment must be a power of 2");
+    }
+    alignedpool(const alignedpool&) = delete;
+
+    size_t bufsize() const { return _bufsize; }
+    size_t alignment() const { return _alignment; }
+
+    buffer get()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if (!_free.empty()) {
+                buffer b(this, std::move(_free.back()));
+                _free.pop_back();
+                return b;
+            }
+        }
+        return buffer(this, alignedbuffer(_bufsize, _alignment));
+    }
+
+    // the number of unused buffers
+    size_t available()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _free.size();
+    }
+private:
+    void put(alignedbuffer&& buf)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        if (_free.size() < _maxfree)
+            _free.push_back(std::move(buf));
+    }
+};
+
+struct directfile {
+    filehandle _f;
+    size_t _blocksize;      // required offset and size alignment
+    size_t _memalign;       // required buffer alignment
+    bool _isregular;
+    alignedpool _pool;
+
+    // the size of the pool's bounce buffers.
+    static constexpr size_t defaultbufsize = 0x100000;
+
+    directfile(const std::string& filename, int openflags = O_RDONLY, int mode = 0666, size_t bufsize = defaultbufsize)
+        : directfile(opendirect(filename, openflags, mode), bufsize)
+    {
+    }
+    // `f` should already be opened with O_DIRECT.
+    directfile(filehandle f, size_t bufsize = defaultbufsize)
+        : directfile(f, getalignment(f), bufsize)
+    {
+    }
+    directfile(const directfile&) = delete;
+
+    filehandle& fh() { return _f; }
+
+    // the logical block size: offsets and sizes of direct transfers are multiples of this.
+    size_t blocksize() const { return _blocksize; }
+    // the required alignment of memory buffers.
+    size_t memalign() const { return _memalign; }
+
+    // pool of aligned buffers, which can be passed directly to pread and pwrite.
+    alignedpool& pool() { return _pool; }
+
+    uint64_t size() { return _f.size(); }
+
+    bool isaligned(uint64_t ofs, const void *ptr, size_t count) const
+    {
+        return (ofs % _blocksize) == 0 && (count % _blocksize) == 0 && (uintptr_t(ptr) % _memalign) == 0;
+    }
+
+    // read upto count bytes, returns less than count only at EOF.
+    size_t pread(uint64_t ofs, uint8_t *ptr, size_t count)
+    {
+        size_t total = 0;
+        while (total < count) {
+            uint64_t pos = ofs + total;
+            uint8_t *p = ptr + total;
+            size_t remaining = count - total;
+
+            if (isaligned(pos, p, 0) && remaining >= _blocksize) {
+                size_t want = std::min(remaining - remaining % _blocksize, maxtransfer());
+                size_t n = syspread(pos, p, want);
+                total += n;
+                if (n < want)
+                    break;
+                continue;
+            }
+            // unaligned: read the surrounding blocks into a bounce buffer.
+            auto buf = _pool.get();
+            uint64_t start = pos - pos % _blocksize;
+            size_t skip = pos - start;
+            size_t want = std::min(buf.size(), roundup(skip + remaining));
+            size_t n = syspread(start, buf.data(), want);
+            if (n <= skip)
+                break;
+            size_t used = std::min(n - skip, remaining);
+            std::memcpy(p, buf.data() + skip, used);
+            total += used;
+            if (n < want)
+                break;
+        }
+        return total;
+    }
+
+    // write count bytes, partial blocks are read, modified and written back.
+    size_t pwrite(uint64_t ofs, const uint8_t *ptr, size_t count)
+    {
+        uint64_t oldsize = _isregular ? _f.size() : 0;
+        uint64_t written = 0;  // end of the blocks actually written
+        size_t total = 0;
+        while (total < count) {
+            uint64_t pos = ofs + total;
+            const uint8_t *p = ptr + total;
+            size_t remaining = count - total;
+
+            if (isaligned(pos, p, 0) && remaining >= _blocksize) {
+                size_t want = std::min(remaining - remaining % _blocksize, maxtransfer());
+                syspwrite(pos, p, want);
+                total += want;
+                written = pos + want;
+                continue;
+            }
+            auto buf = _pool.get();
+            uint64_t start = pos - pos % _blocksize;
+            size_t skip = pos - start;
+            size_t len = std::min(buf.size(), roundup(skip + remaining));
+            size_t used = std::min(len - skip, remaining);
+            if (skip || used < len - skip) {
+                size_t n = (!_isregular || start < oldsize) ? syspread(start, buf.data(), len) : 0;
+                std::memset(buf.data() + n, 0, len - n);
+            }
+            std::memcpy(buf.data() + skip, p, used);
+            syspwrite(start, buf.data(), len);
+            total += used;
+            written = start + len;
+        }
+        // writing whole blocks may have extended the file past the requested size.
+        if (_isregular && written > std::max(oldsize, ofs + count))
+            _f.trunc(std::max(oldsize, ofs + count));
+        return total;
+    }
+
+private:
+    struct alignment {
+        size_t blocksize;
+        size_t memalign;
+        bool isregular;
+    };
+    directfile(filehandle f, const alignment& a, size_t bufsize)
+        : _f(f), _blocksize(a.blocksize), _memalign(a.memalign), _isregular(a.isregular),
+          _pool(std::max(a.blocksize, bufsize - bufsize % a.blocksize), std::max(a.blocksize, a.memalign))
+    {
+    }
+
+    static filehandle opendirect(const std::string& filename, int openflags, int mode)
+    {
+#ifdef O_DIRECT
+        filehandle f(filename, openflags | O_DIRECT, mode);
+#else
+        filehandle f(filename, openflags, mode);
+#ifdef F_NOCACHE
+        if (-1 == ::fcntl(f.fh(), F_NOCACHE, 1))
+            throw std::system_error(errno, std::generic_category(), "fcntl(F_NOCACHE)");
+#endif
+#endif
+        return f;
+    }
+
+    static alignment getalignment(filehandle& f)
+    {
+        struct stat st;
+        if (::fstat(f.fh(), &st))
+            throw std::system_error(errno, std::generic_category(), "fstat");
+        alignment a{ 0, 0, S_ISREG(st.st_mode) };
+
+#if defined(__linux__) && defined(STATX_DIOALIGN)
+        struct statx stx;
+        if (0 == ::statx(f.fh(), "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) && (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align) {
+            a.blocksize = stx.stx_dio_offset_align;
+            a.memalign = stx.stx_dio_mem_align;
+        }
+#endif
+#ifdef BLKSSZGET
+        if (a.blocksize == 0 && S_ISBLK(st.st_mode)) {
+            int bs;
+            if (-1 == ::ioctl(f.fh(), BLKSSZGET, &bs))
+                throw std::system_error(errno, std::generic_category(), "ioctl(BLKSSZGET)");
+            a.blocksize = bs;
+        }
+#endif
+#ifdef DKIOCGETBLOCKSIZE
+        if (a.blocksize == 0 && S_ISBLK(st.st_mode)) {
+            uint32_t bs;
+            if (-1 == ::ioctl(f.fh(), DKIOCGETBLOCKSIZE, &bs))
+                throw std::system_error(errno, std::generic_category(), "ioctl(DKIOCGETBLOCKSIZE)");
+            a.blocksize = bs;
+        }
+#endif
+        // the preferred io size is always a safe choice for regular files.
+        if (a.blocksize == 0)
+            a.blocksize = std::max(blksize_t(512), st.st_blksize);
+        if (a.memalign == 0)
+            a.memalign = a.blocksize;
+        return a;
+    }
+
+    size_t roundup(size_t n) const { return ((n + _blocksize - 1) / _blocksize) * _blocksize; }
+    // the largest aligned transfer in one syscall.
+    size_t maxtransfer() const { return 0x40000000 - 0x40000000 % _blocksize; }
+
+    size_t syspread(uint64_t ofs, uint8_t *ptr, size_t count)
+    {
+        while (true) {
+            auto rc = ::pread(_f.fh(), ptr, count, ofs);
+            if (rc >= 0)
+                return rc;
+            if (errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "pread");
+        }
+    }
+    void syspwrite(uint64_t ofs, const uint8_t *ptr, size_t count)
+    {
+        while (count) {
+            auto rc = ::pwrite(_f.fh(), ptr, count, ofs);
+            if (rc == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "pwrite");
+            }
+            ptr += rc;
+            ofs += rc;
+            count -= rc;
+        }
+    }
+};
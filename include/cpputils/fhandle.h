@@ -2,6 +2,8 @@
 #include <memory>
 #include <vector>
 #include <span>
+#include <algorithm>
+#include <initializer_list>
 #include <stdexcept>
 #include <system_error>
 
@@ -17,10 +19,14 @@
 #endif
 #ifdef __linux__
 #include <linux/fs.h>
+#include <sys/sendfile.h>
 #endif
 
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <limits.h>
+#include <array>
 #endif
 #include <fcntl.h>
 
@@ -196,6 +202,31 @@ struct filehandle {
 #endif
     }
 
+    // flush the file's data to disk, and the metadata needed to read it back, like the size.
+    void datasync()
+    {
+#ifdef _WIN32
+        if (-1==::_commit(fh()))
+            throw std::system_error(errno, std::generic_category(), "commit");
+#elif defined(__APPLE__)
+        if (-1==::fsync(fh()))
+            throw std::system_error(errno, std::generic_category(), "fsync");
+#else
+        if (-1==::fdatasync(fh()))
+            throw std::system_error(errno, std::generic_category(), "fdatasync");
+#endif
+    }
+    // flush the file's data and all metadata to disk.
+    void fsync()
+    {
+#ifdef _WIN32
+        datasync();
+#else
+        if (-1==::fsync(fh()))
+            throw std::system_error(errno, std::generic_category(), "fsync");
+#endif
+    }
+
     // ============================= write =============================
     // write    (PTR ptr, size_t count) -> size_t
     // write    (const RANGE& r) -> size_t
@@ -309,4 +340,321 @@ struct filehandle {
         return rc/sizeof(*ptr);
     }
 
+#ifndef _WIN32
+    // ============================= vectored io =============================
+    // writev   (const RANGES& ranges) -> size_t
+    // pwritev  (uint64_t ofs, const RANGES& ranges) -> size_t
+    // readv    (const RANGES& ranges) -> size_t
+    // preadv   (uint64_t ofs, const RANGES& ranges) -> size_t
+    // writevall  (const RANGES& ranges) -> uint64_t
+    // pwritevall (uint64_t ofs, const RANGES& ranges) -> uint64_t
+    //
+    // RANGES is a container of contiguous ranges, like std::span, std::vector or std::string.
+    // The single call variants return the total number of bytes transferred, which, like with `write`,
+    // may be less than the total size of the ranges. Like the syscalls, these fail with EINVAL
+    // for more than IOV_MAX ranges.
+    // writevall and pwritevall continue after partial writes, and split long lists in
+    // chunks of at most IOV_MAX ranges, so all data is written.
+
+    // converts a list of ranges to an iovec array, without allocating for short lists.
+    struct iovecs {
+#ifdef IOV_MAX
+        static constexpr size_t maxcount = IOV_MAX;
+#else
+        static constexpr size_t maxcount = 1024;
+#endif
+        std::array<iovec, 16> fixed;
+        std::vector<iovec> dynamic;
+        iovec *vec = nullptr;
+        int count = 0;
+
+        template<typename RANGES>
+        iovecs(const RANGES& ranges)
+        {
+            size_t n = std::size(ranges);
+            if (n <= fixed.size()) {
+                vec = fixed.data();
+            }
+            else {
+                dynamic.resize(n);
+                vec = dynamic.data();
+            }
+            for (auto& r : ranges) {
+                vec[count].iov_base = (void*)std::data(r);
+                vec[count].iov_len = std::size(r)*sizeof(*std::data(r));
+                count++;
+            }
+        }
+        // `vec` may point into `fixed`
+        iovecs(const iovecs&) = delete;
+        iovecs& operator=(const iovecs&) = delete;
+    };
+
+    template<typename RANGES>
+    size_t writev(const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        auto rc = ::writev(fh(), v.vec, v.count);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "writev");
+        return rc;
+    }
+    size_t writev(std::initializer_list<std::span<const uint8_t>> ranges)
+    {
+        return writev<std::initializer_list<std::span<const uint8_t>>>(ranges);
+    }
+
+    template<typename RANGES>
+    size_t pwritev(uint64_t ofs, const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        auto rc = ::pwritev(fh(), v.vec, v.count, ofs);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "pwritev");
+        return rc;
+    }
+    size_t pwritev(uint64_t ofs, std::initializer_list<std::span<const uint8_t>> ranges)
+    {
+        return pwritev<std::initializer_list<std::span<const uint8_t>>>(ofs, ranges);
+    }
+
+    template<typename RANGES>
+    uint64_t writevall(const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        return writeiovall(v, [this](const iovec *vec, int n, uint64_t) { return ::writev(fh(), vec, n); }, "writev");
+    }
+    uint64_t writevall(std::initializer_list<std::span<const uint8_t>> ranges)
+    {
+        return writevall<std::initializer_list<std::span<const uint8_t>>>(ranges);
+    }
+    template<typename RANGES>
+    uint64_t pwritevall(uint64_t ofs, const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        return writeiovall(v, [this, ofs](const iovec *vec, int n, uint64_t done) { return ::pwritev(fh(), vec, n, ofs + done); }, "pwritev");
+    }
+    uint64_t pwritevall(uint64_t ofs, std::initializer_list<std::span<const uint8_t>> ranges)
+    {
+        return pwritevall<std::initializer_list<std::span<const uint8_t>>>(ofs, ranges);
+    }
+
+    template<typename RANGES>
+    size_t readv(const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        auto rc = ::readv(fh(), v.vec, v.count);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "readv");
+        return rc;
+    }
+    size_t readv(std::initializer_list<std::span<uint8_t>> ranges)
+    {
+        return readv<std::initializer_list<std::span<uint8_t>>>(ranges);
+    }
+
+    template<typename RANGES>
+    size_t preadv(uint64_t ofs, const RANGES& ranges)
+    {
+        iovecs v(ranges);
+        auto rc = ::preadv(fh(), v.vec, v.count, ofs);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "preadv");
+        return rc;
+    }
+    size_t preadv(uint64_t ofs, std::initializer_list<std::span<uint8_t>> ranges)
+    {
+        return preadv<std::initializer_list<std::span<uint8_t>>>(ofs, ranges);
+    }
+
+    // ============================= transfer =============================
+    // copyrange (const filehandle& dst, size_t count) -> size_t
+    // copyrange (uint64_t ofs, const filehandle& dst, uint64_t dstofs, size_t count) -> size_t
+    // sendfile  (const filehandle& dst, size_t count) -> size_t
+    // sendfile  (uint64_t ofs, const filehandle& dst, size_t count) -> size_t
+    // splice    (const filehandle& dst, size_t count) -> size_t
+    // copyto    (const filehandle& dst, uint64_t count) -> uint64_t
+    // pcopyto   (uint64_t ofs, const filehandle& dst, uint64_t dstofs, uint64_t count) -> uint64_t
+    //
+    // copyrange, sendfile and splice are single linux syscalls, which move data
+    // between files without copying it to userspace. Like `write`, these may
+    // transfer less than requested, and return 0 at EOF.
+    //
+    // copyto and pcopyto transfer `count` bytes, or until EOF, using the best
+    // available method, falling back to a read/write loop through a per-thread
+    // buffer. They return the number of bytes transferred.
+    // The non-offset variants use and update the filepointers of both handles,
+    // the offset variants don't modify the filepointers.
+#ifdef __linux__
+    size_t copyrange(const filehandle& dst, size_t count)
+    {
+        auto rc = ::copy_file_range(fh(), nullptr, dst.fh(), nullptr, count, 0);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "copy_file_range");
+        return rc;
+    }
+    size_t copyrange(uint64_t ofs, const filehandle& dst, uint64_t dstofs, size_t count)
+    {
+        loff_t inofs = ofs, outofs = dstofs;
+        auto rc = ::copy_file_range(fh(), &inofs, dst.fh(), &outofs, count, 0);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "copy_file_range");
+        return rc;
+    }
+    size_t sendfile(const filehandle& dst, size_t count)
+    {
+        auto rc = ::sendfile(dst.fh(), fh(), nullptr, count);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "sendfile");
+        return rc;
+    }
+    size_t sendfile(uint64_t ofs, const filehandle& dst, size_t count)
+    {
+        off_t inofs = ofs;
+        auto rc = ::sendfile(dst.fh(), fh(), &inofs, count);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "sendfile");
+        return rc;
+    }
+    // either this, or `dst` must be a pipe.
+    size_t splice(const filehandle& dst, size_t count)
+    {
+        auto rc = ::splice(fh(), nullptr, dst.fh(), nullptr, count, SPLICE_F_MOVE);
+        if (rc == -1)
+            throw std::system_error(errno, std::generic_category(), "splice");
+        return rc;
+    }
+#endif
+
+    uint64_t copyto(const filehandle& dst, uint64_t count)
+    {
+        uint64_t total = 0;
+#ifdef __linux__
+        // the syscalls are tried in order, errors indicating the method is not
+        // supported for these filehandles switch to the next method.
+        for (int method = 0 ; method < 2 && total < count ; ) {
+            size_t want = std::min(count - total, uint64_t(maxtransfer));
+            ssize_t rc = method==0 ? ::copy_file_range(fh(), nullptr, dst.fh(), nullptr, want, 0)
+                                   : ::sendfile(dst.fh(), fh(), nullptr, want);
+            if (rc == 0)
+                return total;
+            if (rc > 0) {
+                total += rc;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (!unsupported(errno))
+                throw std::system_error(errno, std::generic_category(), method==0 ? "copy_file_range" : "sendfile");
+            method++;
+        }
+#endif
+        auto buf = transferbuffer();
+        while (total < count) {
+            size_t n = read(buf.data(), std::min(count - total, uint64_t(buf.size())));
+            if (n == 0)
+                break;
+            writeall(dst, buf.data(), n);
+            total += n;
+        }
+        return total;
+    }
+
+    uint64_t pcopyto(uint64_t ofs, const filehandle& dst, uint64_t dstofs, uint64_t count)
+    {
+        uint64_t total = 0;
+#ifdef __linux__
+        while (total < count) {
+            loff_t inofs = ofs + total, outofs = dstofs + total;
+            size_t want = std::min(count - total, uint64_t(maxtransfer));
+            auto rc = ::copy_file_range(fh(), &inofs, dst.fh(), &outofs, want, 0);
+            if (rc == 0)
+                return total;
+            if (rc > 0) {
+                total += rc;
+                continue;
+            }
+            if (errno == EINTR)
+                continue;
+            if (!unsupported(errno))
+                throw std::system_error(errno, std::generic_category(), "copy_file_range");
+            break;
+        }
+#endif
+        auto buf = transferbuffer();
+        while (total < count) {
+            size_t n = pread(ofs + total, buf.data(), std::min(count - total, uint64_t(buf.size())));
+            if (n == 0)
+                break;
+            for (size_t done = 0 ; done < n ; ) {
+                auto rc = ::pwrite(dst.fh(), buf.data() + done, n - done, dstofs + total + done);
+                if (rc == -1)
+                    throw std::system_error(errno, std::generic_category(), "pwrite");
+                done += rc;
+            }
+            total += n;
+        }
+        return total;
+    }
+
+    // the linux syscalls transfer at most 0x7ffff000 bytes per call.
+    static constexpr size_t maxtransfer = 0x40000000;
+
+    // errors returned by copy_file_range or sendfile when the files don't support it.
+    static bool unsupported(int err)
+    {
+        return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == ESPIPE;
+    }
+
+    // reused by all copyto calls on the current thread, so these don't allocate.
+    static std::span<uint8_t> transferbuffer()
+    {
+        thread_local std::vector<uint8_t> buf(0x40000);
+        return buf;
+    }
+    // calls `write(vec, n, byteswritten)` until all iovecs are written, adjusting
+    // the iovecs after partial writes.
+    template<typename FN>
+    static uint64_t writeiovall(iovecs& v, FN write, const char *what)
+    {
+        iovec *p = v.vec;
+        iovec *end = v.vec + v.count;
+        uint64_t total = 0;
+        while (true) {
+            while (p < end && p->iov_len == 0)
+                p++;
+            if (p == end)
+                return total;
+            int n = std::min(size_t(end - p), iovecs::maxcount);
+            auto rc = write(p, n, total);
+            if (rc == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), what);
+            }
+            if (rc == 0)
+                throw std::runtime_error(std::string(what) + " wrote nothing");
+            total += rc;
+            size_t left = rc;
+            while (left >= p->iov_len) {
+                left -= p->iov_len;
+                p++;
+                if (p == end)
+                    return total;
+            }
+            p->iov_base = (char*)p->iov_base + left;
+            p->iov_len -= left;
+        }
+    }
+    static void writeall(const filehandle& dst, const uint8_t *ptr, size_t count)
+    {
+        while (count) {
+            auto rc = ::write(dst.fh(), ptr, count);
+            if (rc == -1)
+                throw std::system_error(errno, std::generic_category(), "write");
+            ptr += rc;
+            count -= rc;
+        }
+    }
+#endif
 };
@@ -14,6 +14,8 @@
  *   std::cout << string::formatter("%d", 123);
  *   print("%d", 123);
  *   fprint(FILE*, fmt, ...)
+ *   fprint(filehandle, fmt, ...)
+ *   fprint(bufferedwriter&, fmt, ...)   - from bufferedfile.h
  *   stringformat(fmt, ...)   -> std::string
  *   qstringformat(fmt, ...)  -> QString
  *   windebug(fmt, ...)
@@ -0,0 +1,418 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <map>
+#include <optional>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <cpputils/fslibrary.h>
+#include <cpputils/fhandle.h>
+#include <cpputils/bufferedfile.h>
+#include <cpputils/mmfile.h>
+
+/*
+ * A persistent index of a directory tree, storing the inode, size, mode and mtime of each entry.
+ *
+ *   fsindex idx("tree.idx");
+ *   idx.build("/data");         // full scan
+ *   ...
+ *   idx.refresh();              // only reads the directories which changed
+ *
+ *   idx.foreach([](std::string_view dir, const fsindex::entry& e) { ... });
+ *   auto e = idx.find("/data/some/file");
+ *
+ * The index is saved to `indexfile`, and used from a read-only memory mapping.
+ *
+ * `refresh` stats every indexed directory, and only reads the directories with a
+ * changed mtime or inode. So the cost is proportional to the number of directories
+ * plus the number of changed directories, not to the number of files.
+ * Note that modifying a file in place does not change its directory's mtime, these
+ * changes are found by passing the directories reported by `fswatcher` to `refresh`.
+ *
+ * Directories modified less than `RACYSECONDS` before a scan are always read again
+ * during the next refresh, since their mtime may not have changed with a modification
+ * made within the filesystem's timestamp granularity.
+ *
+ * The file uses the native byte order.
+ */
+class fsindex {
+public:
+    struct entry {
+        std::string_view name;
+        uint32_t mode = 0;
+        uint64_t ino = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;      // nanoseconds since the epoch
+
+        bool isdir() const { return S_ISDIR(mode); }
+    };
+    static constexpr int RACYSECONDS = 2;
+
+private:
+    struct fileheader {
+        char magic[8];
+        uint64_t ndirs;
+        uint64_t nentries;
+        uint64_t strsize;
+        uint64_t rootofs;
+        uint64_t rootlen;
+        int64_t scantime;
+    };
+    // followed by dirrecord[ndirs], entrecord[nentries], char strings[strsize]
+    struct dirrecord {
+        uint64_t pathofs;
+        uint64_t pathlen;
+        uint64_t ino;
+        int64_t mtime;
+        uint64_t first;     // index of the first entrecord
+        uint64_t count;
+    };
+    struct entrecord {
+        uint64_t nameofs;
+        uint32_t namelen;
+        uint32_t mode;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime;
+    };
+    static constexpr char MAGIC[8] = { 'F', 'S', 'I', 'N', 'D', 'E', 'X', '1' };
+
+    // the directories found during a scan.
+    struct newentry {
+        std::string name;
+        uint32_t mode;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime;
+    };
+    struct newdir {
+        std::string path;
+        uint64_t ino;
+        int64_t mtime;
+        std::vector<newentry> ents;
+    };
+
+    std::string _filename;
+    std::optional<mappedfile> _map;
+    const fileheader *_hdr = nullptr;
+    const dirrecord *_dirs = nullptr;
+    const entrecord *_ents = nullptr;
+    const char *_strings = nullptr;
+
+    fileenumerator::dirstream _ds;
+public:
+    // loads `indexfile` when it exists.
+    fsindex(const std::string& indexfile)
+        : _filename(indexfile)
+    {
+        if (::access(indexfile.c_str(), F_OK) == 0)
+            load();
+    }
+    fsindex(const fsindex&) = delete;
+
+    bool empty() const { return _hdr == nullptr; }
+    std::string_view root() const { return _hdr ? str(_hdr->rootofs, _hdr->rootlen) : std::string_view(); }
+    size_t dircount() const { return _hdr ? _hdr->ndirs : 0; }
+    size_t entrycount() const { return _hdr ? _hdr->nentries : 0; }
+
+    // scan the complete tree below `root`
+    void build(const std::string& root)
+    {
+        scan(normalize(root), false, {});
+    }
+
+    // read only the directories which changed since the last scan, or which are listed in `changed`.
+    // returns the number of directories read.
+    size_t refresh(const std::set<std::string>& changed = {})
+    {
+        if (!_hdr)
+            throw std::runtime_error("fsindex: refresh without index");
+        return scan(std::string(root()), true, changed);
+    }
+
+    // calls fn(std::string_view dir, const entry& e) for all entries, ordered by directory and name.
+    template<typename FN>
+    void foreach(FN fn) const
+    {
+        for (size_t d = 0 ; d < dircount() ; d++) {
+            auto dir = str(_dirs[d].pathofs, _dirs[d].pathlen);
+            for (uint64_t i = _dirs[d].first ; i < _dirs[d].first + _dirs[d].count ; i++)
+                fn(dir, getentry(_ents[i]));
+        }
+    }
+    // calls fn(std::string_view dir) for all indexed directories.
+    template<typename FN>
+    void foreachdir(FN fn) const
+    {
+        for (size_t d = 0 ; d < dircount() ; d++)
+            fn(str(_dirs[d].pathofs, _dirs[d].pathlen));
+    }
+
+    std::optional<entry> find(std::string_view path) const
+    {
+        auto slash = path.rfind('/');
+        if (slash == path.npos)
+            return {};
+        auto dir = finddir(slash == 0 ? path.substr(0, 1) : path.substr(0, slash));
+        if (!dir)
+            return {};
+        auto name = path.substr(slash+1);
+        auto first = _ents + dir->first;
+        auto last = first + dir->count;
+        auto i = std::lower_bound(first, last, name, [this](const entrecord& e, std::string_view n) { return str(e.nameofs, e.namelen) < n; });
+        if (i == last || str(i->nameofs, i->namelen) != name)
+            return {};
+        return getentry(*i);
+    }
+
+private:
+    std::string_view str(uint64_t ofs, uint64_t len) const { return std::string_view(_strings + ofs, len); }
+    entry getentry(const entrecord& e) const
+    {
+        return entry{ str(e.nameofs, e.namelen), e.mode, e.ino, e.size, e.mtime };
+    }
+    // directory records are sorted by path.
+    const dirrecord *finddir(std::string_view path) const
+    {
+        auto first = _dirs;
+        auto last = _dirs + dircount();
+        auto i = std::lower_bound(first, last, path, [this](const dirrecord& d, std::string_view p) { return str(d.pathofs, d.pathlen) < p; });
+        if (i == last || str(i->pathofs, i->pathlen) != path)
+            return nullptr;
+        return i;
+    }
+
+    static std::string normalize(std::string path)
+    {
+        while (path.size() > 1 && path.back() == '/')
+            path.pop_back();
+        return path;
+    }
+    static std::string join(const std::string& dir, std::string_view name)
+    {
+        std::string path = dir;
+        if (path.empty() || path.back() != '/')
+            path += '/';
+        path += name;
+        return path;
+    }
+    static int64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return int64_t(ts.tv_sec)*1000000000 + ts.tv_nsec;
+    }
+
+    void readdir(newdir& d)
+    {
+        if (!_ds.open(d.path.c_str()))
+            return;
+        while (auto ent = _ds.next()) {
+            if (fileenumerator::isdirlink(ent->d_name))
+                continue;
+            auto si = fileenumerator::statentry(_ds.fd(), ent->d_name, fileenumerator::STAT_MODE|fileenumerator::STAT_INO|fileenumerator::STAT_SIZE|fileenumerator::STAT_MTIME);
+            if (si.fields == 0)
+                continue;   // removed while reading
+            d.ents.push_back(newentry{ ent->d_name, si.mode, si.ino, si.size, si.mtime });
+        }
+        _ds.close();
+        std::sort(d.ents.begin(), d.ents.end(), [](auto& a, auto& b) { return a.name < b.name; });
+    }
+
+    size_t scan(const std::string& root, bool reuse, const std::set<std::string>& changed)
+    {
+        int64_t scantime = now();
+        int64_t stablebefore = _hdr ? _hdr->scantime - int64_t(RACYSECONDS)*1000000000 : 0;
+        size_t nread = 0;
+
+        std::vector<newdir> dirs;
+        std::vector<std::string> todo = { root };
+        while (!todo.empty()) {
+            newdir d;
+            d.path = std::move(todo.back());
+            todo.pop_back();
+
+            // the root may be a symlink to a directory, links below it are not followed.
+            bool isroot = dirs.empty();
+            auto si = fileenumerator::statentry(AT_FDCWD, d.path.c_str(), fileenumerator::STAT_MODE|fileenumerator::STAT_INO|fileenumerator::STAT_MTIME, isroot);
+            if (isroot && si.fields == 0)
+                throw std::system_error(errno, std::generic_category(), root);
+            if (isroot && !S_ISDIR(si.mode))
+                throw std::system_error(ENOTDIR, std::generic_category(), root);
+            if (si.fields == 0 || !S_ISDIR(si.mode))
+                continue;
+            d.ino = si.ino;
+            d.mtime = si.mtime;
+
+            auto old = reuse ? finddir(d.path) : nullptr;
+            if (old && old->ino == d.ino && old->mtime == d.mtime && d.mtime < stablebefore && changed.count(d.path) == 0) {
+                for (uint64_t i = old->first ; i < old->first + old->count ; i++) {
+                    auto e = getentry(_ents[i]);
+                    d.ents.push_back(newentry{ std::string(e.name), e.mode, e.ino, e.size, e.mtime });
+                }
+            }
+            else {
+                readdir(d);
+                nread++;
+            }
+            for (auto& e : d.ents)
+                if (S_ISDIR(e.mode))
+                    todo.push_back(join(d.path, e.name));
+            dirs.push_back(std::move(d));
+        }
+        std::sort(dirs.begin(), dirs.end(), [](auto& a, auto& b) { return a.path < b.path; });
+
+        save(root, dirs, scantime);
+        load();
+        return nread;
+    }
+
+    // write to a temporary file, then rename it, so the index is replaced atomically.
+    void save(const std::string& root, const std::vector<newdir>& dirs, int64_t scantime)
+    {
+        std::string strings;
+        std::vector<dirrecord> dtab;
+        std::vector<entrecord> etab;
+        auto addstr = [&strings](std::string_view s) { auto ofs = strings.size(); strings += s; return ofs; };
+
+        fileheader hdr = {};
+        std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+        hdr.rootofs = addstr(root);
+        hdr.rootlen = root.size();
+        hdr.scantime = scantime;
+        for (auto& d : dirs) {
+            dtab.push_back(dirrecord{ addstr(d.path), d.path.size(), d.ino, d.mtime, etab.size(), d.ents.size() });
+            for (auto& e : d.ents)
+                etab.push_back(entrecord{ addstr(e.name), uint32_t(e.name.size()), e.mode, e.ino, e.size, e.mtime });
+        }
+        hdr.ndirs = dtab.size();
+        hdr.nentries = etab.size();
+        hdr.strsize = strings.size();
+
+        auto tmpname = _filename + ".tmp";
+        filehandle f(tmpname, O_RDWR|O_CREAT|O_TRUNC, 0666);
+        {
+            bufferedwriter w(f);
+            w.write((const uint8_t*)&hdr, sizeof(hdr));
+            w.write((const uint8_t*)dtab.data(), dtab.size()*sizeof(dirrecord));
+            w.write((const uint8_t*)etab.data(), etab.size()*sizeof(entrecord));
+            w.write((const uint8_t*)strings.data(), strings.size());
+            w.flush();
+        }
+        f.datasync();
+        f.close();
+
+        // unmap the old index before replacing it.
+        _map.reset();
+        _hdr = nullptr;
+        if (::rename(tmpname.c_str(), _filename.c_str()))
+            throw std::system_error(errno, std::generic_category(), "rename");
+    }
+
+    void load()
+    {
+        _map.reset();
+        _hdr = nullptr;
+        _map.emplace(_filename);
+        if (_map->size() < sizeof(fileheader))
+            throw std::runtime_error("fsindex: invalid index file");
+        auto p = _map->begin();
+        auto hdr = (const fileheader*)p;
+        if (std::memcmp(hdr->magic, MAGIC, sizeof(MAGIC)))
+            throw std::runtime_error("fsindex: invalid index file");
+        uint64_t needed = sizeof(fileheader) + hdr->ndirs*sizeof(dirrecord) + hdr->nentries*sizeof(entrecord) + hdr->strsize;
+        if (_map->size() < needed)
+            throw std::runtime_error("fsindex: truncated index file");
+
+        _dirs = (const dirrecord*)(p + sizeof(fileheader));
+        _ents = (const entrecord*)(_dirs + hdr->ndirs);
+        _strings = (const char*)(_ents + hdr->nentries);
+        _hdr = hdr;
+    }
+};
+#ifdef __linux__
+/*
+ * Collects the directories in which something changed, using inotify.
+ *
+ *   fswatcher w;
+ *   w.watch(idx);
+ *   ...
+ *   idx.refresh(w.changes());
+ *   w.watch(idx);       // also watch new directories
+ *
+ * Unlike the directory mtime, this also notices files modified in place.
+ * When the kernel's event queue overflowed, all watched directories are reported.
+ */
+class fswatcher {
+    filehandle _f;
+    std::map<int, std::string> _dirs;   // watch descriptor -> path
+public:
+    fswatcher()
+        : _f(::inotify_init1(IN_NONBLOCK|IN_CLOEXEC))
+    {
+        if (_f.fh() == -1)
+            throw std::system_error(errno, std::generic_category(), "inotify_init1");
+    }
+    // returns false when the directory can not be watched, for instance when it no longer exists,
+    // or when the max_user_watches limit was reached.
+    bool watch(const std::string& dir)
+    {
+        int wd = ::inotify_add_watch(_f.fh(), dir.c_str(), IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_ONLYDIR);
+        if (wd == -1)
+            return false;
+        _dirs[wd] = dir;
+        return true;
+    }
+    void watch(const fsindex& idx)
+    {
+        idx.foreachdir([this](std::string_view dir) { watch(std::string(dir)); });
+    }
+    size_t watched() const { return _dirs.size(); }
+
+    // the directories with events since the last call.
+    std::set<std::string> changes()
+    {
+        std::set<std::string> changed;
+        alignas(inotify_event) char buf[0x10000];
+        while (true) {
+            auto n = ::read(_f.fh(), buf, sizeof(buf));
+            if (n <= 0) {
+                if (n < 0 && errno != EAGAIN && errno != EINTR)
+                    throw std::system_error(errno, std::generic_category(), "read(inotify)");
+                if (n < 0 && errno == EINTR)
+                    continue;
+                break;
+            }
+            for (char *p = buf ; p < buf + n ; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+                auto ev = (inotify_event*)p;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    for (auto& [wd, dir] : _dirs)
+                        changed.insert(dir);
+                    continue;
+                }
+                auto i = _dirs.find(ev->wd);
+                if (i == _dirs.end())
+                    continue;
+                changed.insert(i->second);
+                if (ev->mask & IN_IGNORED)
+                    _dirs.erase(i);
+            }
+        }
+        return changed;
+    }
+};
+#endif
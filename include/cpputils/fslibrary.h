@@ -4,6 +4,28 @@
 #include <cpputils/stringlibrary.h>
 #ifndef _WIN32
 #include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <regex>
+#include <fnmatch.h>
+#endif
+#if defined(__linux__) && defined(__LP64__)
+// on 64 bit linux, `struct dirent` has the same layout as the kernel's `linux_dirent64`,
+// so the entries returned by getdents64 can be used in place.
+#include <sys/syscall.h>
+#define FSLIB_HAVE_GETDENTS
 #endif
 #ifdef _WIN32
 #include <windows.h>
@@ -18,9 +40,16 @@
  *  for (auto [fn, ent] : fileenumerator(path))
  *     handlefile(fn)
  *
- *  for (auto [fn, ent] : fileenumerator(path, 1<<DT_DIR))
+ * On posix systems `fn` is a std::string_view, valid until the next iteration.
+ *
+ *  for (auto [fn, ent] : fileenumerator(path, fileenumerator::FILT_DIRECTORY))
  *     handledir(fn)
  *
+ *  for (auto [fn, ent] : fileenumerator(path).glob("*.cpp").skipdirs([](auto path, auto& ent) { return ent.name() == ".git"; }))
+ *     handlesource(fn)
+ *
+ *  for (auto [fn, ent] : fileenumerator(path).withstat(fileenumerator::STAT_SIZE))
+ *     total += ent.st->size;
  */
 
 struct pathvector {
@@ -62,12 +91,6 @@ struct pathvector {
  *  so i can use this with a mock filesystem in a unittest.
  *
  *  TODO: implement search strategies
- *
- *  TODO: implement directory filter.
- *
- *  TODO: add flag specifying which entries to yield.
- *
- *  TODO: yield struct with path/filename + dirent instead of filename.
  */
 struct fileenumerator {
     pathvector path;
@@ -80,35 +103,121 @@ struct fileenumerator {
     };
     RecursionType recurse;
     enum FilterType {
-        FILT_DIRECTORY=1,
-        FILT_REGULAR=2,
-        FILT_SYMLINK=4,
+#ifndef _WIN32
+        FILT_DIRECTORY = 1<<DT_DIR,
+        FILT_REGULAR = 1<<DT_REG,
+        FILT_SYMLINK = 1<<DT_LNK,
+#else
+        FILT_DIRECTORY = FILE_ATTRIBUTE_DIRECTORY,
+        FILT_REGULAR = FILE_ATTRIBUTE_NORMAL,
+        FILT_SYMLINK = FILE_ATTRIBUTE_REPARSE_POINT,
+#endif
+        FILT_ALL = ~0,
     };
     int filter;  // bitmask of FILT_xxx values
 
 #ifndef _WIN32
+    // which fields `withstat` should retrieve.
+    enum StatField {
+        STAT_MODE = 1,
+        STAT_INO = 2,
+        STAT_NLINK = 4,
+        STAT_SIZE = 8,
+        STAT_BLOCKS = 16,
+        STAT_MTIME = 32,
+        STAT_CTIME = 64,
+    };
+    struct statinfo {
+        int fields = 0;     // STAT_xxx bits which are valid
+        uint32_t mode = 0;
+        uint64_t ino = 0;
+        uint64_t nlink = 0;
+        uint64_t size = 0;
+        uint64_t blocks = 0;    // in 512 byte units
+        int64_t mtime = 0;      // in nanoseconds since the epoch
+        int64_t ctime = 0;
+    };
+    // stats the selected fields of one entry, with statx, only the requested fields are retrieved,
+    // which can be cheaper on network filesystems.
+    // symlinks are not followed, unless `follow` is set.
+    static statinfo statentry(int dirfd, const char *name, int fields, bool follow = false)
+    {
+        statinfo si;
+#ifdef STATX_BASIC_STATS
+        unsigned mask = 0;
+        if (fields & STAT_MODE) mask |= STATX_TYPE|STATX_MODE;
+        if (fields & STAT_INO) mask |= STATX_INO;
+        if (fields & STAT_NLINK) mask |= STATX_NLINK;
+        if (fields & STAT_SIZE) mask |= STATX_SIZE;
+        if (fields & STAT_BLOCKS) mask |= STATX_BLOCKS;
+        if (fields & STAT_MTIME) mask |= STATX_MTIME;
+        if (fields & STAT_CTIME) mask |= STATX_CTIME;
+        struct statx st;
+        if (::statx(dirfd, name, (follow ? 0 : AT_SYMLINK_NOFOLLOW)|AT_NO_AUTOMOUNT, mask, &st))
+            return si;
+        auto ns = [](const statx_timestamp& t) { return int64_t(t.tv_sec)*1000000000 + t.tv_nsec; };
+        if (st.stx_mask & STATX_MODE) { si.fields |= STAT_MODE; si.mode = st.stx_mode; }
+        if (st.stx_mask & STATX_INO) { si.fields |= STAT_INO; si.ino = st.stx_ino; }
+        if (st.stx_mask & STATX_NLINK) { si.fields |= STAT_NLINK; si.nlink = st.stx_nlink; }
+        if (st.stx_mask & STATX_SIZE) { si.fields |= STAT_SIZE; si.size = st.stx_size; }
+        if (st.stx_mask & STATX_BLOCKS) { si.fields |= STAT_BLOCKS; si.blocks = st.stx_blocks; }
+        if (st.stx_mask & STATX_MTIME) { si.fields |= STAT_MTIME; si.mtime = ns(st.stx_mtime); }
+        if (st.stx_mask & STATX_CTIME) { si.fields |= STAT_CTIME; si.ctime = ns(st.stx_ctime); }
+#else
+        struct stat st;
+        if (::fstatat(dirfd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW))
+            return si;
+#ifdef __APPLE__
+        auto ns = [](const timespec& t) { return int64_t(t.tv_sec)*1000000000 + t.tv_nsec; };
+        si.mtime = ns(st.st_mtimespec);
+        si.ctime = ns(st.st_ctimespec);
+#else
+        auto ns = [](const timespec& t) { return int64_t(t.tv_sec)*1000000000 + t.tv_nsec; };
+        si.mtime = ns(st.st_mtim);
+        si.ctime = ns(st.st_ctim);
+#endif
+        si.fields = STAT_MODE|STAT_INO|STAT_NLINK|STAT_SIZE|STAT_BLOCKS|STAT_MTIME|STAT_CTIME;
+        si.mode = st.st_mode;
+        si.ino = st.st_ino;
+        si.nlink = st.st_nlink;
+        si.size = st.st_size;
+        si.blocks = st.st_blocks;
+#endif
+        (void)fields;
+        return si;
+    }
+    // stat results for the entries already read from a directory
+    struct statbatch {
+        std::vector<statinfo> stats;
+        size_t pos = 0;
+        void clear() { stats.clear(); pos = 0; }
+    };
+
+    // return true for '.' and '..'
+    static bool isdirlink(const char *p)
+    {
+        char c = *p++;
+        if (c != '.')
+            return false;
+        c = *p++;
+        if (c == 0)
+            return true;
+        if (c != '.')
+            return false;
+        c = *p++;
+        return c == 0;
+    }
+
     struct fileent {
         dirent *ent = nullptr;
+        const statinfo *st = nullptr;   // only set when requested with `withstat`
         bool empty() const { return ent==nullptr; }
         std::string name() const { return ent->d_name; }
         bool isdir() const { return ent->d_type == DT_DIR; }
         bool isfile() const { return ent->d_type == DT_REG; }
         bool match(int filter) const { return filter & (1<<ent->d_type); }
         // return true for '.' and '..'
-        bool isdirlink() const
-        {
-            const char *p = ent->d_name;
-            char c = *p++;
-            if (c != '.')
-                return false;
-            c = *p++;
-            if (c == 0)
-                return true;
-            if (c != '.')
-                return false;
-            c = *p++;
-            return c == 0;
-        }
+        bool isdirlink() const { return fileenumerator::isdirlink(ent->d_name); }
         friend std::ostream& operator<<(std::ostream& os, const fileent& f)
         {
             if (f.empty())
@@ -117,17 +226,140 @@ struct fileenumerator {
             return os << stringformat("%10d/i %3d/l x%x/t '%s'", ent->d_ino, ent->d_reclen, ent->d_type, f.name());
         }
     };
+
+    // not all filesystems store the type in the directory entry, use fstatat for those.
+    static void resolvetype(int dirfd, dirent *ent)
+    {
+        if (ent->d_type != DT_UNKNOWN)
+            return;
+        struct stat st;
+        if (::fstatat(dirfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+            ent->d_type = IFTODT(st.st_mode);
+    }
+
+    using namepredicate = std::function<bool(const char *name)>;
+    using prunepredicate = std::function<bool(std::string_view path, const fileent& ent)>;
+    namepredicate namefilter;
+    prunepredicate prune;
+    int statfields = 0;
+
+    // reads a directory using opendir/readdir.
+    struct readdirstream {
+        DIR *d = nullptr;
+
+        bool open(const char *path)
+        {
+            d = ::opendir(path);
+            return d != nullptr;
+        }
+        // open a subdirectory relative to the parent's filehandle,
+        // so the kernel does not have to resolve the full path again.
+        bool openat(int parentfd, const char *name)
+        {
+            int fd = ::openat(parentfd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+            if (fd == -1)
+                return false;
+            d = ::fdopendir(fd);
+            if (d == nullptr) {
+                ::close(fd);
+                return false;
+            }
+            return true;
+        }
+        int fd() const { return ::dirfd(d); }
+        dirent *next() { return ::readdir(d); }
+        // entries are read one at a time, so there is nothing to look ahead at.
+        template<typename FN>
+        void lookahead(FN) { }
+        void close()
+        {
+            if (d && -1==::closedir(d))
+                dbgprint("ERROR in closedir: %s\n", strerror(errno));
+            d = nullptr;
+        }
+    };
+#ifdef FSLIB_HAVE_GETDENTS
+    // reads a directory in bulk using getdents64, the entries are used in place in the buffer.
+    struct getdentsstream {
+        int dirfd = -1;
+        std::vector<char> buf;
+        size_t pos = 0;
+        size_t end = 0;
+
+        getdentsstream(size_t bufsize = 0x40000)
+            : buf(bufsize)
+        {
+        }
+        bool open(const char *path)
+        {
+            return opened(::open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+        }
+        bool openat(int parentfd, const char *name)
+        {
+            return opened(::openat(parentfd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC));
+        }
+        bool opened(int fd)
+        {
+            dirfd = fd;
+            pos = end = 0;
+            return fd != -1;
+        }
+        int fd() const { return dirfd; }
+        dirent *next()
+        {
+            if (pos == end) {
+                auto n = ::syscall(SYS_getdents64, dirfd, buf.data(), buf.size());
+                if (n <= 0) {
+                    if (n < 0)
+                        dbgprint("ERROR in getdents64: %s\n", strerror(errno));
+                    return nullptr;
+                }
+                pos = 0;
+                end = n;
+            }
+            auto ent = (dirent*)(buf.data() + pos);
+            pos += ent->d_reclen;
+            return ent;
+        }
+        // calls fn(dirent*) for the entries remaining in the buffer, without consuming them.
+        template<typename FN>
+        void lookahead(FN fn)
+        {
+            for (size_t p = pos ; p < end ; p += ((dirent*)(buf.data() + p))->d_reclen)
+                fn((dirent*)(buf.data() + p));
+        }
+        void close()
+        {
+            if (dirfd != -1 && -1==::close(dirfd))
+                dbgprint("ERROR in close: %s\n", strerror(errno));
+            dirfd = -1;
+        }
+    };
+    using dirstream = getdentsstream;
+#else
+    using dirstream = readdirstream;
+#endif
+
     struct iter {
-        pathvector path;
+        // the path of the current directory, followed by a '/' and the name of the current entry.
+        // it is modified in place, so no allocations are needed while iterating.
+        std::string pathbuf;
+        std::vector<size_t> dirlens;  // length of the directory part of pathbuf, for each open directory
         RecursionType recurse;
-        std::vector<DIR *> stack;  // stack of opendir handles
+        std::vector<dirstream> stack;  // stack of open directories
+        std::vector<dirstream> spare;  // closed directories, reused for their buffers
+        std::vector<statbatch> batches;  // stat results for each open directory
 
         fileent cur;
+        bool descend = false;   // enter the directory in `cur` when advancing
 
         int filter;  // bitmask of (1<<DT_nnn) values
+        namepredicate namefilter;
+        prunepredicate prune;
+        int statfields = 0;
 
-        iter(pathvector path, RecursionType recurse, int filter)
-            : path(path), recurse(recurse), filter(filter)
+        iter(const fileenumerator& e)
+            : pathbuf(e.path.join()), recurse(e.recurse), filter(e.filter), namefilter(e.namefilter), prune(e.prune), statfields(e.statfields)
         {
             dbgprint("iter.start\n");
         }
@@ -136,7 +368,10 @@ struct fileenumerator {
         {
             dbgprint("iter.default\n");
         }
+        iter(const iter&) = default;
+        iter& operator=(const iter&) = default;
 
+        // returns the path of the current entry, valid until the iterator is advanced.
         auto operator*()
         {
             dbgprint("deref\n");
@@ -146,63 +381,129 @@ struct fileenumerator {
             }
             if (cur.empty())
                 throw std::runtime_error("eof");
-            return std::make_tuple(path.join(cur.name()), cur);
+            return std::make_tuple(curpath(), cur);
         }
-        void push(const std::string& name)
+        std::string_view curpath()
         {
-            dbgprint("push\n");
-            if (!name.empty())
-                path.push_back(name);
-            if (!push())
-                path.pop_back();
+            pathbuf.resize(dirlens.back());
+            pathbuf += cur.ent->d_name;
+            return pathbuf;
+        }
+        dirstream newstream()
+        {
+            if (spare.empty())
+                return dirstream();
+            auto d = std::move(spare.back());
+            spare.pop_back();
+            return d;
         }
+        // open a subdirectory of the current directory
+        bool push(const char *name)
+        {
+            dbgprint("push -> openat: %s\n", name);
+            auto d = newstream();
+            if (!d.openat(stack.back().fd(), name)) {
+                dbgprint("ERROR in openat: %s\n", strerror(errno));
+                spare.push_back(std::move(d));
+                return false;
+            }
+            pathbuf.resize(dirlens.back());
+            pathbuf += name;
+            pathbuf += '/';
+            opened(std::move(d));
+            return true;
+        }
+        // open the root directory
         bool push()
         {
-            dbgprint("push -> opendir: %s\n", path.join());
-            auto p = ::opendir(path.join().c_str());
-            if (p==NULL) {
+            dbgprint("push -> opendir: %s\n", pathbuf);
+            auto d = newstream();
+            if (!d.open(pathbuf.c_str())) {
                 dbgprint("ERROR in opendir: %s\n", strerror(errno));
+                recurse = DONE;
                 return false;
             }
-            stack.push_back(p);
-            dbgprint("opened (%d ; %d) dir %p\n", stack.size(), path.size(), p);
-
-            nextent();
-
+            pathbuf += '/';
+            opened(std::move(d));
             return true;
         }
+        void opened(dirstream&& d)
+        {
+            stack.push_back(std::move(d));
+            dirlens.push_back(pathbuf.size());
+            if (batches.size() < stack.size())
+                batches.resize(stack.size());
+            batches[stack.size()-1].clear();
+            dbgprint("opened (%d) dir\n", stack.size());
+        }
         void pop()
         {
-            dbgprint("pop (%d ; %d)\n", stack.size(), path.size());
-            if (-1==::closedir(stack.back()))
-                dbgprint("ERROR in closedir: %s\n", strerror(errno));
-            dbgprint("closed dir %p\n", stack.back());
+            dbgprint("pop (%d)\n", stack.size());
+            stack.back().close();
+            spare.push_back(std::move(stack.back()));
             stack.pop_back();
-            path.pop_back();
+            dirlens.pop_back();
             if (stack.empty())
             {
                 recurse = DONE;
                 dbgprint("DONE\n");
             }
         }
+        // true when `ent` should be yielded.
+        bool wanted(dirent *ent)
+        {
+            return (filter & (1<<ent->d_type)) && (!namefilter || namefilter(ent->d_name));
+        }
+        // when stat info was requested, stat the current entry, together with the following
+        // entries which are already read from the directory and will be yielded.
+        void getstat()
+        {
+            auto& b = batches[stack.size()-1];
+            if (b.pos == b.stats.size()) {
+                b.clear();
+                auto& d = stack.back();
+                b.stats.push_back(statentry(d.fd(), cur.ent->d_name, statfields));
+                d.lookahead([&](dirent *ent) {
+                    if (isdirlink(ent->d_name))
+                        return;
+                    resolvetype(d.fd(), ent);
+                    if (wanted(ent))
+                        b.stats.push_back(statentry(d.fd(), ent->d_name, statfields));
+                });
+            }
+            cur.st = &b.stats[b.pos++];
+        }
         bool nextent()
         {
             dbgprint("nextent\n");
+            if (descend) {
+                descend = false;
+                push(cur.ent->d_name);
+            }
+            cur.st = nullptr;
             while (!stack.empty()) {
-                cur.ent = ::readdir(stack.back());
+                cur.ent = stack.back().next();
                 dbgprint("read dir(%d) -> %s\n", stack.size(), cur);
                 if (!cur.ent) {
-                    dbgprint("ERROR in readdir: %s\n", strerror(errno));
                     pop();
+                    continue;
                 }
-                else if (!cur.isdirlink())
-                {
-                    if (cur.isdir())
-                        push(cur.name());
-                    //if (cur.match(filter))
-                        return true;
+                if (cur.isdirlink())
+                    continue;
+                resolvetype(stack.back().fd(), cur.ent);
+
+                bool enter = cur.isdir() && !(prune && prune(curpath(), cur));
+                if (wanted(cur.ent)) {
+                    if (statfields)
+                        getstat();
+                    // the directory is entered after it was yielded.
+                    descend = enter;
+                    return true;
                 }
+                if (enter)
+                    push(cur.ent->d_name);
             }
+            cur.ent = nullptr;
             return false;
         }
         iter& operator++()
@@ -216,9 +517,8 @@ struct fileenumerator {
             dbgprint("op!=\n");
             if (recurse == DONE && rhs.recurse == DONE)
                 return false;
-            if (cur.empty()) {
-                push();
-            }
+            if (cur.empty() && push())
+                nextent();
             return cur.empty() != rhs.cur.empty() || recurse != rhs.recurse;
         }
     };
@@ -374,16 +674,233 @@ struct fileenumerator {
         }
     };
 #endif
-    fileenumerator(const std::string& path, int filter=FILT_DIRECTORY, RecursionType recurse=SINGLE)
+    // by default all entries except directories are yielded.
+    fileenumerator(const std::string& path, int filter=FILT_ALL&~FILT_DIRECTORY, RecursionType recurse=SINGLE)
         : path{path}, recurse(recurse), filter(filter)
     {
     }
+#ifndef _WIN32
+    // only yield entries for which pred(name) returns true, this does not affect which directories are entered.
+    fileenumerator match(namepredicate pred) const
+    {
+        auto e = *this;
+        e.namefilter = pred;
+        return e;
+    }
+    // only yield entries with a name matching a shell wildcard pattern.
+    fileenumerator glob(const std::string& pattern) const
+    {
+        return match([pattern](const char *name) { return ::fnmatch(pattern.c_str(), name, FNM_PERIOD) == 0; });
+    }
+    // only yield entries with a name matching a regular expression.
+    fileenumerator regex(const std::string& pattern) const
+    {
+        auto re = std::make_shared<std::regex>(pattern);
+        return match([re](const char *name) { return std::regex_match(name, *re); });
+    }
+    // don't enter directories for which pred(path, ent) returns true.
+    fileenumerator skipdirs(prunepredicate pred) const
+    {
+        auto e = *this;
+        e.prune = pred;
+        return e;
+    }
+    // retrieve the STAT_xxx fields for all yielded entries, available through `ent.st`.
+    // entries already read from the directory are stat'ed in a batch, ahead of being yielded.
+    fileenumerator withstat(int fields) const
+    {
+        auto e = *this;
+        e.statfields = fields;
+        return e;
+    }
+    iter begin() const
+    {
+        return iter(*this);
+    }
+#else
     iter begin() const
     {
         return iter(path, recurse, filter);
     }
+#endif
     iter end() const
     {
         return iter{};
     }
 };
+
+#ifndef _WIN32
+/*
+ * Walks a directory tree using a pool of threads.
+ *
+ *   parallelwalk(path, [](const std::string& fn, const fileenumerator::fileent& ent) {
+ *       ...
+ *   });
+ *
+ * The callback is called concurrently from the worker threads, for every entry
+ * below `root`, except `.` and `..`, in no particular order.
+ * Each worker keeps a queue of directories it found, idle workers steal directories
+ * from the other queues. A worker has only one directory open at a time, so at most
+ * `nthreads` directory handles are in use.
+ *
+ * An exception thrown from the callback stops the walk, and is rethrown from parallelwalk.
+ */
+class parallelwalker {
+    using callback = std::function<void(const std::string& path, const fileenumerator::fileent& ent)>;
+
+    struct workqueue {
+        std::mutex mtx;
+        std::deque<std::string> dirs;
+    };
+    std::vector<std::unique_ptr<workqueue>> _queues;
+    callback _fn;
+
+    std::atomic<size_t> _pending{0};    // directories queued, or being read.
+    std::atomic<size_t> _queued{0};     // directories queued, waiting for a worker.
+    std::atomic<bool> _stopping{false};
+    std::mutex _idlemtx;
+    std::condition_variable _idlecv;
+    std::exception_ptr _error;
+
+public:
+    parallelwalker(callback fn, unsigned nthreads = 0)
+        : _fn(fn)
+    {
+        if (nthreads == 0)
+            nthreads = std::max(2u, std::thread::hardware_concurrency());
+        for (unsigned i = 0 ; i < nthreads ; i++)
+            _queues.emplace_back(std::make_unique<workqueue>());
+    }
+
+    void walk(const std::string& root)
+    {
+        // an earlier walk which was stopped by an exception may have left directories behind.
+        for (auto& q : _queues)
+            q->dirs.clear();
+        _pending = 1;
+        _queued = 1;
+        _stopping = false;
+        _error = nullptr;
+        _queues[0]->dirs.push_back(root);
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0 ; i < _queues.size() ; i++)
+            threads.emplace_back([this, i]() { worker(i); });
+        for (auto& t : threads)
+            t.join();
+
+        if (_error)
+            std::rethrow_exception(_error);
+    }
+
+private:
+    bool getwork(size_t ix, std::string& dir)
+    {
+        {
+            // own queue: most recently found directory first, for locality.
+            auto& q = *_queues[ix];
+            std::unique_lock<std::mutex> lock(q.mtx);
+            if (!q.dirs.empty()) {
+                dir = std::move(q.dirs.back());
+                q.dirs.pop_back();
+                _queued--;
+                return true;
+            }
+        }
+        for (size_t i = 1 ; i < _queues.size() ; i++) {
+            // steal the oldest directory, which likely has the largest subtree.
+            auto& q = *_queues[(ix + i) % _queues.size()];
+            std::unique_lock<std::mutex> lock(q.mtx);
+            if (!q.dirs.empty()) {
+                dir = std::move(q.dirs.front());
+                q.dirs.pop_front();
+                _queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(size_t ix)
+    {
+        std::string dir;
+        fileenumerator::dirstream d;    // reused, so its buffer is allocated only once per worker
+        while (!_stopping) {
+            if (!getwork(ix, dir)) {
+                // sleep until work is queued, or the walk is finished.
+                std::unique_lock<std::mutex> lock(_idlemtx);
+                _idlecv.wait(lock, [this]() { return _stopping || _pending == 0 || _queued > 0; });
+                if (_pending == 0)
+                    break;
+                continue;
+            }
+            try {
+                readdir(ix, d, dir);
+            }
+            catch (...) {
+                std::unique_lock<std::mutex> lock(_idlemtx);
+                if (!_error)
+                    _error = std::current_exception();
+                _stopping = true;
+                _idlecv.notify_all();
+            }
+            if (--_pending == 0)
+                wakeall();
+        }
+    }
+    // the waiters check their condition with _idlemtx locked, taking the lock
+    // here ensures a notification is not lost between that check and the wait.
+    void wakeall()
+    {
+        { std::unique_lock<std::mutex> lock(_idlemtx); }
+        _idlecv.notify_all();
+    }
+
+    void readdir(size_t ix, fileenumerator::dirstream& d, const std::string& dir)
+    {
+        if (!d.open(dir.c_str()))
+            return;
+        struct closer {
+            fileenumerator::dirstream& d;
+            ~closer() { d.close(); }
+        } closer{d};
+
+        std::string path = dir;
+        if (path.empty() || path.back() != '/')
+            path += '/';
+        size_t dirlen = path.size();
+
+        std::vector<std::string> subdirs;
+        fileenumerator::fileent ent;
+        while (!_stopping && (ent.ent = d.next()) != nullptr) {
+            if (ent.isdirlink())
+                continue;
+            path.resize(dirlen);
+            path += ent.ent->d_name;
+
+            fileenumerator::resolvetype(d.fd(), ent.ent);
+            if (ent.isdir())
+                subdirs.push_back(path);
+
+            _fn(path, ent);
+        }
+        if (subdirs.empty())
+            return;
+
+        _pending += subdirs.size();
+        {
+            auto& q = *_queues[ix];
+            std::unique_lock<std::mutex> lock(q.mtx);
+            for (auto& s : subdirs)
+                q.dirs.push_back(std::move(s));
+            _queued += subdirs.size();
+        }
+        wakeall();
+    }
+};
+
+inline void parallelwalk(const std::string& root, std::function<void(const std::string& path, const fileenumerator::fileent& ent)> fn, unsigned nthreads = 0)
+{
+    parallelwalker(fn, nthreads).walk(root);
+}
+#endif
@@ -0,0 +1,242 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <system_error>
+#include <exception>
+#include <utility>
+#include <sys/stat.h>
+
+#include <cpputils/fslibrary.h>
+#include <cpputils/fhandle.h>
+#include <cpputils/crccalc.h>
+
+/*
+ * A queue with a fixed capacity: `push` blocks while the queue is full,
+ * `pop` blocks while it is empty.
+ * After `close`, push returns false, and pop returns the remaining items, then nullopt.
+ */
+template<typename T>
+class boundedqueue {
+    std::mutex _mtx;
+    std::condition_variable _notfull;
+    std::condition_variable _notempty;
+    std::deque<T> _q;
+    size_t _capacity;
+    bool _closed = false;
+public:
+    boundedqueue(size_t capacity)
+        : _capacity(std::max(size_t(1), capacity))
+    {
+    }
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _notfull.wait(lock, [this]() { return _closed || _q.size() < _capacity; });
+        if (_closed)
+            return false;
+        _q.push_back(std::move(item));
+        _notempty.notify_one();
+        return true;
+    }
+    std::optional<T> pop()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _notempty.wait(lock, [this]() { return _closed || !_q.empty(); });
+        if (_q.empty())
+            return {};
+        auto item = std::move(_q.front());
+        _q.pop_front();
+        _notfull.notify_one();
+        return item;
+    }
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _closed = true;
+        _notfull.notify_all();
+        _notempty.notify_all();
+    }
+};
+
+struct hashoptions {
+    enum { CRC32 = 1, CRC64 = 2 };
+    int algorithms = CRC32;
+    unsigned nthreads = 0;          // 0: one per cpu
+    size_t chunksize = 0x100000;    // each thread reads one chunk at a time, so at most nthreads*chunksize bytes are in flight
+    size_t maxqueued = 1024;        // capacity of the file and result queues
+    uint64_t minsize = 0;           // skip smaller files
+    bool samesizeonly = false;      // only hash files with a size shared by another file, for finding duplicates
+};
+
+/*
+ * Walks a directory tree, and computes checksums of all regular files on a pool of threads.
+ *
+ *   hashpipeline hp("/data", { .algorithms = hashoptions::CRC32|hashoptions::CRC64 });
+ *   while (auto r = hp.next())
+ *       print("%08x %016x %s\n", r->crc32, r->crc64, r->path);
+ *
+ * Results are returned in order of completion. When the consumer does not keep up,
+ * the result queue fills up, which stops the hashing threads, and then the walker.
+ *
+ * With `samesizeonly`, the whole tree is walked before hashing starts, and only files
+ * with a size which occurs more than once are hashed. Files which can't be read are
+ * returned with `error` set to the errno value. Errors while walking the tree, like a
+ * missing root, are rethrown by `next` after the results found so far.
+ *
+ * The destructor stops the pipeline, also when not all results were consumed.
+ */
+class hashpipeline {
+public:
+    struct result {
+        std::string path;
+        uint64_t size = 0;
+        uint32_t crc32 = 0;
+        uint64_t crc64 = 0;
+        int error = 0;
+    };
+private:
+    struct job {
+        std::string path;
+        uint64_t size;
+    };
+    hashoptions _opt;
+    boundedqueue<job> _jobs;
+    boundedqueue<result> _results;
+    std::atomic<bool> _stopping{false};
+    std::atomic<unsigned> _running{0};
+    std::atomic<uint64_t> _bytes{0};
+    std::atomic<uint64_t> _files{0};
+    std::exception_ptr _walkerror;      // set by the walker before it closes the job queue
+    std::vector<std::thread> _threads;
+public:
+    hashpipeline(const std::string& root, hashoptions opt = hashoptions())
+        : _opt(opt), _jobs(opt.maxqueued), _results(opt.maxqueued)
+    {
+        if (_opt.nthreads == 0)
+            _opt.nthreads = std::max(1u, std::thread::hardware_concurrency());
+        _opt.chunksize = std::max(size_t(0x1000), _opt.chunksize);
+
+        _running = _opt.nthreads;
+        for (unsigned i = 0 ; i < _opt.nthreads ; i++)
+            _threads.emplace_back([this]() { worker(); });
+        _threads.emplace_back([this, root]() { walker(root); });
+    }
+    hashpipeline(const hashpipeline&) = delete;
+    ~hashpipeline()
+    {
+        _stopping = true;
+        _jobs.close();
+        _results.close();
+        for (auto& t : _threads)
+            t.join();
+    }
+
+    // blocks until the next result is available, returns nullopt after the last file.
+    // rethrows the error which ended the walk, after all results.
+    std::optional<result> next()
+    {
+        auto r = _results.pop();
+        if (!r && _walkerror)
+            std::rethrow_exception(std::exchange(_walkerror, nullptr));
+        return r;
+    }
+
+    // the number of bytes and files hashed so far.
+    uint64_t bytes() const { return _bytes; }
+    uint64_t files() const { return _files; }
+
+private:
+    void walker(const std::string& root)
+    {
+        try {
+            // the enumerator yields nothing for a missing root, report it here.
+            struct stat st;
+            if (::stat(root.c_str(), &st))
+                throw std::system_error(errno, std::generic_category(), root);
+            if (_opt.samesizeonly) {
+                std::map<uint64_t, std::vector<std::string>> bysize;
+                for (auto [fn, ent] : fileenumerator(root, fileenumerator::FILT_REGULAR).withstat(fileenumerator::STAT_SIZE)) {
+                    if (_stopping)
+                        break;
+                    if (ent.st->fields && ent.st->size >= _opt.minsize)
+                        bysize[ent.st->size].emplace_back(fn);
+                }
+                for (auto& [size, paths] : bysize) {
+                    if (paths.size() < 2 || _stopping)
+                        continue;
+                    for (auto& p : paths)
+                        if (!_jobs.push(job{std::move(p), size}))
+                            break;
+                }
+            }
+            else {
+                for (auto [fn, ent] : fileenumerator(root, fileenumerator::FILT_REGULAR).withstat(fileenumerator::STAT_SIZE)) {
+                    if (ent.st->fields == 0 || ent.st->size < _opt.minsize)
+                        continue;
+                    if (!_jobs.push(job{std::string(fn), ent.st->size}))
+                        break;
+                }
+            }
+        }
+        catch (...) {
+            _walkerror = std::current_exception();
+        }
+        _jobs.close();
+    }
+
+    void worker()
+    {
+        std::vector<uint8_t> buf(_opt.chunksize);
+        while (!_stopping) {
+            auto j = _jobs.pop();
+            if (!j)
+                break;
+            if (!_results.push(hash(*j, buf)))
+                break;
+        }
+        // the last worker to finish ends the result stream.
+        if (--_running == 0)
+            _results.close();
+    }
+
+    result hash(job& j, std::vector<uint8_t>& buf)
+    {
+        result r;
+        r.path = std::move(j.path);
+        r.size = j.size;
+        uint32_t c32 = ~uint32_t(0);
+        uint64_t c64 = ~uint64_t(0);
+        try {
+            filehandle f(r.path);
+            uint64_t total = 0;
+            while (!_stopping) {
+                size_t n = f.read(buf.data(), buf.size());
+                if (n == 0)
+                    break;
+                if (_opt.algorithms & hashoptions::CRC32)
+                    c32 = crc32(c32, buf.data(), n);
+                if (_opt.algorithms & hashoptions::CRC64)
+                    c64 = crc64(c64, buf.data(), n);
+                total += n;
+            }
+            // the file may have changed since it was stat'ed.
+            r.size = total;
+            _bytes += total;
+            _files++;
+        }
+        catch (const std::system_error& e) {
+            r.error = e.code().value();
+        }
+        r.crc32 = c32 ^ ~uint32_t(0);
+        r.crc64 = c64 ^ ~uint64_t(0);
+        return r;
+    }
+};
@@ -20,6 +20,10 @@ enum {
 #include <stdint.h>
 #include <algorithm>
 #include <system_error>
+#include <memory>
+#include <span>
+#include <map>
+#include <mutex>
 
 #ifdef __ANDROID_API__
 extern "C" void*  __mmap2(void*, size_t, int, int, int, size_t);
@@ -56,13 +60,17 @@ https://opensource.apple.com/source/xnu/xnu-2422.1.72/bsd/kern/kern_mman.c
 
 
 // class for creating a memory mapped file.
-// TODO: create internal sharedptr like I did in filehandle.
+// use `std::shared_ptr<mappedmem>` with `mappedview` to share a mapping.
 struct mappedmem {
     uint8_t *pmem;
     uint64_t phys_length;
     uint64_t dataofs;
     uint64_t length;
 
+    // page aligned ranges marked by `markdirty`, as offsets from pmem: first -> last.
+    std::map<uint64_t, uint64_t> _dirty;
+    std::mutex _dirtymtx;
+
     static uint64_t round_up(uint64_t ofs, uint64_t base)
     {
         return ((ofs-1)|(base-1))+1;
@@ -79,6 +87,7 @@ struct mappedmem {
         phys_length = mm.phys_length;
         dataofs = mm.dataofs;
         length = mm.length;
+        _dirty = std::move(mm._dirty);
 
         mm.pmem= nullptr;
     }
@@ -104,7 +113,90 @@ struct mappedmem {
             throw std::system_error(errno, std::generic_category(), "mmap");
     }
 
-    // todo: add madvise support
+    // takes ownership of an existing mapping of phys_length bytes at pmem.
+    mappedmem(uint8_t *pmem, uint64_t phys_length, uint64_t length)
+        : pmem(pmem), phys_length(phys_length), dataofs(0), length(length)
+    {
+    }
+
+    // access pattern hints, passed to madvise.
+    enum Advice {
+        NORMAL,
+        SEQUENTIAL,     // pages will be accessed in order, read ahead aggressively.
+        RANDOM,         // don't read ahead.
+        WILLNEED,       // start reading these pages.
+        DONTNEED,       // the pages can be dropped from memory.
+        HUGEPAGE,       // use transparent huge pages, for anonymous mappings.
+        NOHUGEPAGE,
+    };
+
+    // give a hint for the range [ptr, ptr+len), which is extended to page boundaries.
+    // returns false when the hint is not supported on this platform.
+    static bool adviserange(const void *ptr, uint64_t len, Advice advice)
+    {
+        int adv;
+        switch (advice) {
+            case NORMAL: adv = MADV_NORMAL; break;
+            case SEQUENTIAL: adv = MADV_SEQUENTIAL; break;
+            case RANDOM: adv = MADV_RANDOM; break;
+            case WILLNEED: adv = MADV_WILLNEED; break;
+            case DONTNEED: adv = MADV_DONTNEED; break;
+#ifdef MADV_HUGEPAGE
+            case HUGEPAGE: adv = MADV_HUGEPAGE; break;
+            case NOHUGEPAGE: adv = MADV_NOHUGEPAGE; break;
+#endif
+            default: return false;
+        }
+        uint64_t pagesize= std::max(0x1000, (int)sysconf(_SC_PAGE_SIZE));
+        uint64_t first = round_down(uint64_t(ptr), pagesize);
+        uint64_t last = round_up(uint64_t(ptr) + len, pagesize);
+        if (first == last)
+            return true;
+        if (madvise((void*)first, last-first, adv)) {
+            if (errno == EINVAL && (advice==HUGEPAGE || advice==NOHUGEPAGE))
+                return false;
+            throw std::system_error(errno, std::generic_category(), "madvise");
+        }
+        return true;
+    }
+
+    // fault in the range [ptr, ptr+len), blocking until the data has been read.
+    static void populaterange(const void *ptr, uint64_t len)
+    {
+        uint64_t pagesize= std::max(0x1000, (int)sysconf(_SC_PAGE_SIZE));
+        uint64_t first = round_down(uint64_t(ptr), pagesize);
+        uint64_t last = round_up(uint64_t(ptr) + len, pagesize);
+        if (first == last)
+            return;
+#ifdef MADV_POPULATE_READ
+        if (0 == madvise((void*)first, last-first, MADV_POPULATE_READ))
+            return;
+        if (errno != EINVAL)
+            throw std::system_error(errno, std::generic_category(), "madvise(POPULATE_READ)");
+#endif
+        // kernels before 5.14: touch each page.
+        for (uint64_t p = first ; p < last ; p += pagesize)
+            (void)*(volatile const uint8_t*)p;
+    }
+
+    // hint for the range ofs..ofs+len of this mapping, by default the whole mapping.
+    bool advise(Advice advice, uint64_t ofs = 0, uint64_t len = ~uint64_t(0))
+    {
+        clip(ofs, len);
+        return adviserange(data() + ofs, len, advice);
+    }
+    // start reading ofs..ofs+len, without waiting.
+    void prefetch(uint64_t ofs, uint64_t len)
+    {
+        clip(ofs, len);
+        adviserange(data() + ofs, len, WILLNEED);
+    }
+    // read ofs..ofs+len, waiting until it is in memory.
+    void populate(uint64_t ofs, uint64_t len)
+    {
+        clip(ofs, len);
+        populaterange(data() + ofs, len);
+    }
 
     ~mappedmem()
     {
@@ -197,6 +289,76 @@ struct mappedmem {
     }
     uint8_t& operator[](size_t ix) { return data()[ix]; }
 
+    // limit the range ofs..ofs+len to the mapping.
+    void clip(uint64_t& ofs, uint64_t& len) const
+    {
+        ofs = std::min(ofs, length);
+        len = std::min(len, length - ofs);
+    }
+
+    // write modified pages in the range ofs..ofs+len back to the file.
+    // With wait=false, the writeback is only started.
+    void flush(uint64_t ofs, uint64_t len, bool wait = true)
+    {
+        clip(ofs, len);
+        uint64_t pagesize= std::max(uint64_t(0x1000), uint64_t(getpagesize()));
+        syncrange(round_down(dataofs+ofs, pagesize), round_up(dataofs+ofs+len, pagesize), wait);
+    }
+    void flush(bool wait = true)
+    {
+        flush(0, length, wait);
+    }
+
+    // record that ofs..ofs+len was modified, for `flushdirty`.
+    void markdirty(uint64_t ofs, uint64_t len)
+    {
+        clip(ofs, len);
+        if (len == 0)
+            return;
+        uint64_t pagesize= std::max(uint64_t(0x1000), uint64_t(getpagesize()));
+        std::unique_lock<std::mutex> lock(_dirtymtx);
+        adddirty(round_down(dataofs+ofs, pagesize), round_up(dataofs+ofs+len, pagesize));
+    }
+    // the number of bytes in dirty pages.
+    uint64_t dirtysize()
+    {
+        std::unique_lock<std::mutex> lock(_dirtymtx);
+        uint64_t total = 0;
+        for (auto& [first, last] : _dirty)
+            total += last - first;
+        return total;
+    }
+    // flush only the ranges marked dirty.
+    void flushdirty(bool wait = true)
+    {
+        std::map<uint64_t, uint64_t> dirty;
+        {
+            std::unique_lock<std::mutex> lock(_dirtymtx);
+            std::swap(dirty, _dirty);
+        }
+        for (auto i = dirty.begin() ; i != dirty.end() ; ++i) {
+            try {
+                syncrange(i->first, std::min(i->second, phys_length), wait);
+            }
+            catch (...) {
+                // keep the unflushed ranges dirty.
+                std::unique_lock<std::mutex> lock(_dirtymtx);
+                for ( ; i != dirty.end() ; ++i)
+                    adddirty(i->first, i->second);
+                throw;
+            }
+        }
+    }
+
+    // move the dirty ranges of `other`, a mapping of the same file offset, to this mapping.
+    void movedirty(mappedmem& other)
+    {
+        std::scoped_lock lock(_dirtymtx, other._dirtymtx);
+        for (auto& [first, last] : other._dirty)
+            adddirty(first, last);
+        other._dirty.clear();
+    }
+
     // returns true when addresses stayed the same.
     bool resize(uint64_t newsize)
     {
@@ -221,5 +383,84 @@ struct mappedmem {
         return !havemoved;
 #endif
     }
+private:
+    // merge first..last into the dirty ranges, _dirtymtx must be locked.
+    void adddirty(uint64_t first, uint64_t last)
+    {
+        auto it = _dirty.upper_bound(first);
+        if (it != _dirty.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second >= first) {
+                first = prev->first;
+                last = std::max(last, prev->second);
+                _dirty.erase(prev);
+            }
+        }
+        while (it != _dirty.end() && it->first <= last) {
+            last = std::max(last, it->second);
+            it = _dirty.erase(it);
+        }
+        _dirty[first] = last;
+    }
+
+    // offsets are relative to pmem, and page aligned.
+    void syncrange(uint64_t first, uint64_t last, bool wait)
+    {
+        if (first >= last)
+            return;
+#ifndef _WIN32
+        if (msync(pmem + first, last - first, wait ? MS_SYNC : MS_ASYNC))
+            throw std::system_error(errno, std::generic_category(), "msync");
+#else
+        // FlushViewOfFile only starts the writeback.
+        if (!FlushViewOfFile(pmem + first, last - first))
+            throw std::system_error(GetLastError(), std::system_category(), "FlushViewOfFile");
+#endif
+    }
 };
 
+/*
+ * a sub-range of a shared mapping, the view keeps the mapping alive.
+ *
+ * Views are cheap to copy, and can be passed to other threads.
+ *
+ *   auto m = std::make_shared<mappedmem>(f, 0, f.size(), PROT_READ);
+ *   mappedview all(m);
+ *   mappedview rec = all.subview(hdrsize, recsize);
+ */
+struct mappedview {
+    std::shared_ptr<mappedmem> _m;
+    std::span<uint8_t> _s;
+
+    mappedview() { }
+    mappedview(std::shared_ptr<mappedmem> m)
+        : _m(m), _s(m ? std::span<uint8_t>(m->data(), m->size()) : std::span<uint8_t>())
+    {
+    }
+    mappedview(std::shared_ptr<mappedmem> m, std::span<uint8_t> s)
+        : _m(m), _s(s)
+    {
+    }
+
+    uint8_t *data() const { return _s.data(); }
+    size_t size() const { return _s.size(); }
+    bool empty() const { return _s.empty(); }
+    uint8_t *begin() const { return data(); }
+    uint8_t *end() const { return data() + size(); }
+    uint8_t& operator[](size_t ix) const { return _s[ix]; }
+
+    std::span<uint8_t> span() const { return _s; }
+    operator std::span<uint8_t>() const { return _s; }
+    operator std::span<const uint8_t>() const { return _s; }
+
+    // the range ofs..ofs+len of this view, clipped to the view.
+    mappedview subview(size_t ofs, size_t len = ~size_t(0)) const
+    {
+        ofs = std::min(ofs, _s.size());
+        len = std::min(len, _s.size() - ofs);
+        return mappedview(_m, _s.subspan(ofs, len));
+    }
+
+    // the mapping this is a view of.
+    const std::shared_ptr<mappedmem>& mapping() const { return _m; }
+};
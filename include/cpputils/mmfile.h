@@ -1,6 +1,9 @@
 #pragma once
 
 #include <fcntl.h>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
 
 #include <cpputils/mmem.h>
 #include <cpputils/fhandle.h>
@@ -13,14 +16,16 @@ Note: this object may be quite unnescesary, since the mmap manual states:
    immediately without invalidating the mapping.
 
  */
-// todo: make this copyable.
+// copies of a mappedfile share the mapping, until one of them is grown.
 class mappedfile {
     filehandle _f;
-    mappedmem _m;
+    std::shared_ptr<mappedmem> _m;
+    int _mmapmode;
 public:
     mappedfile(filehandle fh, int mmapmode)
         : _f(fh),
-        _m(_f, 0, _f.size(), mmapmode)
+        _m(std::make_shared<mappedmem>(_f, 0, _f.size(), mmapmode)),
+        _mmapmode(mmapmode)
     {
     }
 
@@ -35,15 +40,139 @@ public:
     auto file() { return _f; }
 
 
-    auto size() { return _m.size(); }
-    auto begin() { return _m.begin(); }
-    auto end() { return _m.end(); }
+    auto size() { return _m->size(); }
+    auto begin() { return _m->begin(); }
+    auto end() { return _m->end(); }
+
+    // a view of ofs..ofs+len, which keeps the mapping alive, also after `resize`.
+    mappedview view(uint64_t ofs = 0, uint64_t len = ~uint64_t(0)) { return mappedview(_m).subview(ofs, len); }
+    const std::shared_ptr<mappedmem>& mapping() const { return _m; }
+
+    // write modified pages back to the file, with wait=false the writeback is only started.
+    void flush(bool wait = true) { _m->flush(wait); }
+    void flush(uint64_t ofs, uint64_t len, bool wait = true) { _m->flush(ofs, len, wait); }
+
+    // record modified ranges, so `sync` only needs to write those.
+    void markdirty(uint64_t ofs, uint64_t len) { _m->markdirty(ofs, len); }
+    void flushdirty(bool wait = true) { _m->flushdirty(wait); }
+
+    // durability point: write the dirty ranges, and the file size.
+    void sync()
+    {
+        _m->flushdirty(true);
+        _f.datasync();
+    }
+
+#ifndef _WIN32
+    bool advise(mappedmem::Advice advice, uint64_t ofs = 0, uint64_t len = ~uint64_t(0)) { return _m->advise(advice, ofs, len); }
+    void prefetch(uint64_t ofs, uint64_t len) { _m->prefetch(ofs, len); }
+    void populate(uint64_t ofs, uint64_t len) { _m->populate(ofs, len); }
+
+    // read the file range into the page cache, without mapping it in this process.
+    void readahead(uint64_t ofs, uint64_t len)
+    {
+#ifdef __linux__
+        if (::readahead(_f.fh(), ofs, len))
+            throw std::system_error(errno, std::generic_category(), "readahead");
+#elif defined(POSIX_FADV_WILLNEED)
+        if (int rc = ::posix_fadvise(_f.fh(), ofs, len, POSIX_FADV_WILLNEED))
+            throw std::system_error(rc, std::generic_category(), "posix_fadvise");
+#endif
+    }
+#endif
 
     // return true if pointers did not move.
+    //
+    // When copies or views of the mapping exist, growing creates a new mapping, and the
+    // views keep using the old mapping, which stays valid. The dirty ranges move to the new mapping,
+    // ranges marked through old views after the resize are not included in `flushdirty`.
+    // Shrinking throws while views exist, since accessing these past EOF would raise SIGBUS.
+    //
+    // Other owners can only drop references concurrently, not add them, so a use_count of 1
+    // reliably means this object is the only owner.
     bool resize(uint64_t newsize)
     {
+        bool shared = _m.use_count() > 1;
+        if (newsize < size()) {
+            if (shared)
+                throw std::runtime_error("mappedfile: can't shrink while views of the mapping exist");
+            // unmap the tail before truncating, so no mapping extends beyond EOF.
+            bool same = _m->resize(newsize);
+            _f.trunc(newsize);
+            return same;
+        }
         _f.trunc(newsize);
-        return _m.resize(newsize);
+        if (shared) {
+            auto m = std::make_shared<mappedmem>(_f, 0, newsize, _mmapmode);
+            m->movedirty(*_m);
+            _m = m;
+            return false;
+        }
+        return _m->resize(newsize);
     }
 };
 
+/*
+ * group commit: concurrent callers of `commit` share a single call of the sync function.
+ *
+ * `commit` returns after a sync has completed, which started after `commit` was called.
+ * So everything written by the caller before calling `commit` is durable.
+ *
+ *   mappedfile mf(...);
+ *   groupcommit gc([&mf]() { mf.sync(); });
+ *   // in each writer thread:
+ *   memcpy(mf.begin() + ofs, rec, n);
+ *   mf.markdirty(ofs, n);
+ *   gc.commit();
+ */
+class groupcommit {
+    std::function<void()> _sync;
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    uint64_t _requested = 0;    // the number of commit calls
+    uint64_t _completed = 0;    // commits upto this number are durable
+    bool _syncing = false;
+    uint64_t _syncs = 0;
+public:
+    groupcommit(std::function<void()> sync)
+        : _sync(sync)
+    {
+    }
+
+    void commit()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        uint64_t ticket = ++_requested;
+        while (_completed < ticket) {
+            if (_syncing) {
+                _cv.wait(lock);
+                continue;
+            }
+            // become the leader, syncing for all commits requested so far.
+            _syncing = true;
+            uint64_t upto = _requested;
+            lock.unlock();
+            try {
+                _sync();
+            }
+            catch (...) {
+                lock.lock();
+                _syncing = false;
+                _cv.notify_all();
+                throw;
+            }
+            lock.lock();
+            _syncing = false;
+            _completed = std::max(_completed, upto);
+            _syncs++;
+            _cv.notify_all();
+        }
+    }
+
+    // the number of times the sync function was called.
+    uint64_t syncs()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _syncs;
+    }
+};
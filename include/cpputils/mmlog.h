@@ -0,0 +1,214 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <span>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <cpputils/mmem.h>
+#include <cpputils/fhandle.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/*
+ * Append-only memory mapped file, for journals and logs.
+ *
+ * A large range of address space is reserved up front, the file is grown in
+ * chunks, and each chunk is mapped at a fixed address after the previous one.
+ * So unlike `mappedfile::resize`, growing never moves the data, and pointers
+ * into the log remain valid for the lifetime of the `mappedlog`.
+ *
+ *   mappedlog log(filehandle("journal", O_RDWR|O_CREAT));
+ *   uint64_t ofs = log.append(record.data(), record.size());
+ *   log.sync();         // durability point
+ *
+ * Data is written back asynchronously after every `syncinterval` bytes,
+ * `sync` waits until all data appended so far is on disk. Records constructed
+ * in place with `allocate` must be complete before calling `sync`.
+ *
+ * The file starts with a small header holding the size of the log as of the last `sync`.
+ * After a crash, reopening continues after the last synced record, ignoring the
+ * trailing zeros of the preallocated chunk, and any data appended after that sync.
+ * The destructor records the final size, and truncates the file to it.
+ */
+class mappedlog {
+public:
+    static constexpr uint64_t hdrsize = 64;
+private:
+    struct header {
+        char magic[8];
+        uint64_t size;
+    };
+    filehandle _f;
+    uint8_t *_region = nullptr;  // the file is mapped here, the data follows the header.
+    uint8_t *_base = nullptr;
+    uint64_t _reserved;         // size of the reserved address range
+    uint64_t _chunksize;
+    uint64_t _mapped = 0;       // size of the file, and the mapped part of the range
+    uint64_t _size = 0;         // bytes used
+    uint64_t _synced = 0;       // everything before this is on disk, and recorded in the header.
+    uint64_t _flushed = 0;      // asynchronous writeback was started upto here.
+    uint64_t _syncinterval;
+
+public:
+    mappedlog(filehandle f, uint64_t chunksize = 0x4000000, uint64_t reserve = 0x10000000000, uint64_t syncinterval = 0x1000000)
+        : _f(f), _syncinterval(syncinterval)
+    {
+        uint64_t pagesize = std::max(0x1000, (int)sysconf(_SC_PAGE_SIZE));
+        _chunksize = mappedmem::round_up(std::max(chunksize, pagesize), pagesize);
+        _reserved = mappedmem::round_up(std::max(reserve, _chunksize), _chunksize);
+
+        void *p = mmap(NULL, _reserved, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        _region = (uint8_t*)p;
+        _base = _region + hdrsize;
+
+        try {
+            uint64_t filesize = _f.size();
+            if (filesize == 0) {
+                grow(0);
+                std::memcpy(hdr().magic, "MMLOG001", 8);
+                hdr().size = 0;
+            }
+            else {
+                if (filesize < hdrsize)
+                    throw std::runtime_error("mappedlog: file too small");
+                grow(filesize - hdrsize);
+                if (std::memcmp(hdr().magic, "MMLOG001", 8))
+                    throw std::runtime_error("mappedlog: not a log file");
+                if (hdr().size > filesize - hdrsize)
+                    throw std::runtime_error("mappedlog: corrupt header");
+            }
+            _size = _synced = _flushed = hdr().size;
+        }
+        catch (...) {
+            munmap(_region, _reserved);
+            throw;
+        }
+    }
+    mappedlog(const std::string& filename, uint64_t chunksize = 0x4000000)
+        : mappedlog(filehandle(filename, O_RDWR|O_CREAT), chunksize)
+    {
+    }
+    mappedlog(const mappedlog&) = delete;
+    ~mappedlog()
+    {
+        try {
+            hdr().size = _size;
+            msync(_region, _mapped, MS_ASYNC);
+            _f.trunc(hdrsize + _size);
+        }
+        catch (...) {
+        }
+        munmap(_region, _reserved);
+    }
+
+    uint8_t *data() const { return _base; }
+    uint64_t size() const { return _size; }
+    uint8_t *begin() const { return _base; }
+    uint8_t *end() const { return _base + _size; }
+    // bytes that can be appended without growing the file.
+    uint64_t capacity() const { return _mapped - hdrsize; }
+    std::span<uint8_t> span(uint64_t ofs, uint64_t len) const
+    {
+        ofs = std::min(ofs, _size);
+        return { _base + ofs, std::min(len, _size - ofs) };
+    }
+
+    // reserve n bytes at the end of the log, and return a pointer to them,
+    // for constructing records in place.
+    uint8_t *allocate(uint64_t n)
+    {
+        grow(_size + n);
+        uint8_t *p = _base + _size;
+        _size += n;
+        return p;
+    }
+
+    // append data, returns the offset it was written at.
+    uint64_t append(const void *ptr, uint64_t n)
+    {
+        uint64_t ofs = _size;
+        grow(_size + n);
+        std::memcpy(_base + _size, ptr, n);
+        _size += n;
+        if (_size - _flushed >= _syncinterval)
+            startwriteback();
+        return ofs;
+    }
+    template<typename RANGE>
+    uint64_t append(const RANGE& r)
+    {
+        return append(std::data(r), std::size(r)*sizeof(*std::data(r)));
+    }
+
+    // durability point: wait until everything appended so far is written.
+    void sync()
+    {
+        if (_size == _synced)
+            return;
+        // the data must be on disk before the header refers to it.
+        syncrange(hdrsize + _synced, hdrsize + _size, MS_SYNC);
+        hdr().size = _size;
+        syncrange(0, hdrsize, MS_SYNC);
+        // the metadata, like the file size, is not covered by msync.
+        if (::fsync(_f.fh()))
+            throw std::system_error(errno, std::generic_category(), "fsync");
+        _synced = _flushed = _size;
+    }
+
+private:
+    header& hdr() { return *(header*)_region; }
+
+    // start writing back the recently appended pages.
+    // this does not move `_synced`, since records from `allocate` may still be incomplete.
+    void startwriteback()
+    {
+        syncrange(hdrsize + _flushed, hdrsize + _size, MS_ASYNC);
+        _flushed = _size;
+    }
+    // msync the file range first..last
+    void syncrange(uint64_t first, uint64_t last, int flags)
+    {
+        uint64_t pagesize = std::max(0x1000, (int)sysconf(_SC_PAGE_SIZE));
+        first = mappedmem::round_down(first, pagesize);
+        last = mappedmem::round_up(last, pagesize);
+        if (msync(_region + first, last - first, flags))
+            throw std::system_error(errno, std::generic_category(), "msync");
+    }
+
+    // make sure at least `needed` bytes of data are mapped.
+    void grow(uint64_t needed)
+    {
+        needed += hdrsize;
+        if (needed <= _mapped)
+            return;
+        uint64_t newsize = mappedmem::round_up(needed, _chunksize);
+        if (newsize > _reserved)
+            throw std::runtime_error("mappedlog: reserved address range exhausted");
+
+#ifdef __linux__
+        // allocate the blocks now, so a full disk is reported here, instead of as SIGBUS.
+        if (::fallocate(_f.fh(), 0, _mapped, newsize - _mapped)) {
+            if (errno != EOPNOTSUPP && errno != ENOSYS)
+                throw std::system_error(errno, std::generic_category(), "fallocate");
+            _f.trunc(newsize);
+        }
+#else
+        _f.trunc(newsize);
+#endif
+
+        void *p = mmap(_region + _mapped, newsize - _mapped, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, _f.fh(), _mapped);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        _mapped = newsize;
+    }
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <cpputils/mmem.h>
+
+/*
+ * Background prefetcher for sequential scans over a memory mapping.
+ *
+ * A thread faults in the mapping in chunks, staying `ahead` bytes in front of
+ * the position reported by the reader, so the reader does not stall on page faults.
+ *
+ *   mappedfile m("huge.bin");
+ *   mmprefetcher pf(m.begin(), m.size(), 64*1024*1024);
+ *   for (auto p = m.begin() ; p < m.end() ; p += recsize) {
+ *       pf.update(p - m.begin());
+ *       ...
+ *   }
+ *
+ * The prefetcher must be destroyed before the mapping.
+ */
+class mmprefetcher {
+    const uint8_t *_base;
+    uint64_t _size;
+    uint64_t _ahead;
+    uint64_t _chunk;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    uint64_t _pos = 0;      // the reader's position
+    uint64_t _done = 0;     // everything below this has been prefetched
+    bool _stopping = false;
+    std::thread _thread;
+
+public:
+    mmprefetcher(const uint8_t *base, uint64_t size, uint64_t ahead = 0x4000000, uint64_t chunk = 0x400000)
+        : _base(base), _size(size), _ahead(ahead), _chunk(std::max(uint64_t(0x1000), chunk))
+    {
+        _thread = std::thread([this]() { run(); });
+    }
+    mmprefetcher(const mmprefetcher&) = delete;
+    ~mmprefetcher()
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            _stopping = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    // report the current reading position.
+    void update(uint64_t pos)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mtx);
+            if (pos == _pos)
+                return;
+            _pos = pos;
+            // reader skipped ahead of the prefetcher.
+            if (_done < _pos)
+                _done = _pos;
+        }
+        _cv.notify_all();
+    }
+
+    // the offset upto which the data has been prefetched.
+    uint64_t prefetched()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        return _done;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        while (true) {
+            _cv.wait(lock, [this]() { return _stopping || (_done < _size && _done < _pos + _ahead); });
+            if (_stopping)
+                return;
+
+            uint64_t ofs = _done;
+            uint64_t len = std::min(_chunk, _size - ofs);
+            lock.unlock();
+            try {
+                mappedmem::populaterange(_base + ofs, len);
+            }
+            catch (...) {
+                // the prefetch is only a hint, the reader will see any errors itself.
+            }
+            lock.lock();
+            _done = std::max(_done, ofs + len);
+        }
+    }
+};
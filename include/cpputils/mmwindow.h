@@ -0,0 +1,188 @@
+#pragma once
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <span>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include <cpputils/mmem.h>
+#include <cpputils/fhandle.h>
+
+/*
+ * Maps a large file or block device through a limited number of fixed size windows,
+ * so the address space and page tables used stay bounded, regardless of the file size.
+ *
+ * Window `i` maps the file range [i*W, i*W + 2*W), so any range of at most `W` bytes
+ * is contiguous in one window. At most `maxwindows` windows are mapped, the least
+ * recently used window is unmapped when a new one is needed.
+ *
+ *   windowedmapping wm(filehandle("/dev/sdb"), 64*1024*1024);
+ *   auto s = wm.span(ofs, 512);
+ *
+ *   wm.scan(0, wm.size(), [](std::span<const uint8_t> chunk) { ... });
+ *
+ *   unpacker u(wm.begin(), wm.end());
+ *
+ * Note that spans and pointers returned are only valid until their window is unmapped,
+ * which happens after `maxwindows` other windows were used.
+ */
+class windowedmapping {
+    filehandle _f;
+    uint64_t _size;
+    uint64_t _windowsize;
+    size_t _maxwindows;
+    int _mmapmode;
+
+    struct window {
+        uint64_t index;
+        uint64_t lastuse;
+        std::unique_ptr<mappedmem> m;
+    };
+    std::vector<window> _windows;
+    uint64_t _usecounter = 0;
+    uint64_t _evictions = 0;    // invalidates the pointers cached by iterators
+    size_t _last = 0;       // the most recently used entry of _windows
+public:
+    windowedmapping(filehandle f, uint64_t windowsize = 0x4000000, size_t maxwindows = 4, int mmapmode = PROT_READ)
+        : windowedmapping(f, f.size(), windowsize, maxwindows, mmapmode)
+    {
+    }
+    windowedmapping(filehandle f, uint64_t size, uint64_t windowsize, size_t maxwindows, int mmapmode)
+        : _f(f), _size(size), _maxwindows(std::max(size_t(1), maxwindows)), _mmapmode(mmapmode)
+    {
+        // the window size must be a multiple of the pagesize, or on windows, the allocation granularity.
+        _windowsize = mappedmem::round_up(std::max(windowsize, uint64_t(0x10000)), 0x10000);
+    }
+    windowedmapping(const windowedmapping&) = delete;
+
+    uint64_t size() const { return _size; }
+    uint64_t windowsize() const { return _windowsize; }
+    // the number of currently mapped windows.
+    size_t mapped() const { return _windows.size(); }
+
+    // returns upto `len` bytes starting at `ofs`, less only at the end of the file.
+    // `len` can be at most `windowsize`.
+    std::span<uint8_t> span(uint64_t ofs, uint64_t len)
+    {
+        if (len > _windowsize)
+            throw std::runtime_error("windowedmapping: span larger than the windowsize");
+        if (ofs >= _size)
+            return {};
+        len = std::min(len, _size - ofs);
+        uint64_t ix = ofs / _windowsize;
+        return { getwindow(ix).data() + (ofs - ix*_windowsize), len };
+    }
+
+    // the largest contiguous span starting at ofs, which is at least `windowsize` bytes, except near EOF.
+    std::span<uint8_t> chunk(uint64_t ofs)
+    {
+        if (ofs >= _size)
+            return {};
+        uint64_t ix = ofs / _windowsize;
+        auto& m = getwindow(ix);
+        uint64_t skip = ofs - ix*_windowsize;
+        return { m.data() + skip, m.size() - skip };
+    }
+
+    // calls fn(std::span<uint8_t>) for consecutive pieces of the range ofs..ofs+len.
+    template<typename FN>
+    void scan(uint64_t ofs, uint64_t len, FN fn)
+    {
+        uint64_t end = std::min(_size, ofs + len);
+        while (ofs < end) {
+            // only use the first half of each window, so consecutive windows don't overlap.
+            auto s = span(ofs, std::min(_windowsize - ofs % _windowsize, end - ofs));
+            fn(s);
+            ofs += s.size();
+        }
+    }
+
+    /*
+     * random access byte iterator over the whole file, remapping when crossing window boundaries.
+     */
+    struct iterator {
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = uint8_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = uint8_t*;
+        using reference = uint8_t&;
+
+        windowedmapping *wm = nullptr;
+        uint64_t ofs = 0;
+        // cached pointers into the current window, covering [curofs, curofs + (curend-curptr))
+        uint8_t *curptr = nullptr;
+        uint8_t *curend = nullptr;
+        uint64_t curofs = 0;
+        uint64_t generation = 0;
+
+        uint8_t& operator*()
+        {
+            if (generation != wm->_evictions || !(ofs >= curofs && ofs - curofs < uint64_t(curend - curptr))) {
+                auto s = wm->chunk(ofs);
+                if (s.empty())
+                    throw std::out_of_range("windowedmapping: read past end");
+                curptr = s.data();
+                curend = s.data() + s.size();
+                curofs = ofs;
+                generation = wm->_evictions;
+            }
+            return curptr[ofs - curofs];
+        }
+        uint8_t& operator[](difference_type n) { return *(*this + n); }
+
+        iterator& operator++() { ++ofs; return *this; }
+        iterator operator++(int) { auto copy = *this; ++ofs; return copy; }
+        iterator& operator--() { --ofs; return *this; }
+        iterator operator--(int) { auto copy = *this; --ofs; return copy; }
+        iterator& operator+=(difference_type n) { ofs += n; return *this; }
+        iterator& operator-=(difference_type n) { ofs -= n; return *this; }
+        friend iterator operator+(iterator it, difference_type n) { it += n; return it; }
+        friend iterator operator+(difference_type n, iterator it) { it += n; return it; }
+        friend iterator operator-(iterator it, difference_type n) { it -= n; return it; }
+        friend difference_type operator-(const iterator& lhs, const iterator& rhs) { return lhs.ofs - rhs.ofs; }
+
+        friend bool operator==(const iterator& lhs, const iterator& rhs) { return lhs.ofs == rhs.ofs; }
+        friend bool operator!=(const iterator& lhs, const iterator& rhs) { return lhs.ofs != rhs.ofs; }
+        friend bool operator<(const iterator& lhs, const iterator& rhs) { return lhs.ofs < rhs.ofs; }
+        friend bool operator<=(const iterator& lhs, const iterator& rhs) { return lhs.ofs <= rhs.ofs; }
+        friend bool operator>(const iterator& lhs, const iterator& rhs) { return lhs.ofs > rhs.ofs; }
+        friend bool operator>=(const iterator& lhs, const iterator& rhs) { return lhs.ofs >= rhs.ofs; }
+    };
+    iterator begin() { return iterator{this, 0}; }
+    iterator end() { return iterator{this, _size}; }
+    iterator at(uint64_t ofs) { return iterator{this, ofs}; }
+
+private:
+    mappedmem& getwindow(uint64_t ix)
+    {
+        ++_usecounter;
+        if (_last < _windows.size() && _windows[_last].index == ix) {
+            _windows[_last].lastuse = _usecounter;
+            return *_windows[_last].m;
+        }
+        for (size_t i = 0 ; i < _windows.size() ; i++)
+            if (_windows[i].index == ix) {
+                _windows[i].lastuse = _usecounter;
+                _last = i;
+                return *_windows[i].m;
+            }
+
+        uint64_t start = ix * _windowsize;
+        uint64_t end = std::min(_size, start + 2*_windowsize);
+        auto m = std::make_unique<mappedmem>(_f.fh(), start, end, _mmapmode);
+
+        if (_windows.size() < _maxwindows) {
+            _windows.push_back(window{ix, _usecounter, std::move(m)});
+            _last = _windows.size()-1;
+        }
+        else {
+            auto lru = std::min_element(_windows.begin(), _windows.end(), [](auto& a, auto& b) { return a.lastuse < b.lastuse; });
+            *lru = window{ix, _usecounter, std::move(m)};
+            _evictions++;
+            _last = lru - _windows.begin();
+        }
+        return *_windows[_last].m;
+    }
+};
@@ -75,8 +75,14 @@ struct XmlNode {
     std::string attrstring() const
     {
         std::string res;
-        for (auto a : attrs)
-            res += stringformat(" %s=\"%s\"", a.first, a.second);
+        std::string buf;
+        for (auto& a : attrs) {
+            res += ' ';
+            res += a.first;
+            res += "=\"";
+            res += XmlParser::encode_entities(a.second, buf);
+            res += '"';
+        }
         return res;
     }
     std::string childstring() const
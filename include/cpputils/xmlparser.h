@@ -1,45 +1,45 @@
 #pragma once
 #include <string>
 #include <vector>
-#include <memory>
+#include <span>
+#include <string_view>
 #include <algorithm>
 #include <stdexcept>
 #include <utility>
+#include <bit>
+#include <cstdint>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define XMLSCAN_SSE2
+#endif
 
 // TODO: add optional support for non-quoted attribute values, and attributes without a value, so i can parse most html too.
 // TODO: support the nested <!DOCTYPE [ ... ]>  type values.
 
-// TODO: add method for searching attribute_list
 /*
  * XmlParser based upon how the python 'html.parser' works.
+ *
+ *  <?xml  ... ?>      - processing instructions
+ *  <!(?:DOCTYPE|ENTITY|ELEMENT|ATTLIST|INCLUDE|IGNORE|NOTATION) ...> handler
+ *  <starttag ...>   handler
+ *  </endtag >  handler
+ *  <element />    handler
+ *  <!-- comment --> handler
+ *  <![CDATA[ ... ]]>  handler
+ *  ... data handler
+ *  &entity;
+ *
+ * There are two interfaces:
+ *  - XmlSaxParser<DERIVED>: the handlers are found at compile time, and receive
+ *    string_views into the parsed buffer, nothing is allocated per tag.
+ *  - XmlParser: virtual handlers receiving std::string, and decoded attribute lists.
  */
-class XmlParser {
-    //  <?xml  ... ?>      - processing instructions
-    //  <!(?:DOCTYPE|ENTITY|ELEMENT|ATTLIST|INCLUDE|IGNORE|NOTATION) ...> handler
-    //  <starttag ...>   handler
-    //  </endtag >  handler
-    //  <element />    handler
-    //  <!-- comment --> handler
-    //  <![CDATA[ ... ]]>  handler
-    //  ... data handler
-    //  &entity;
+
+// the types and functions shared by both parser interfaces.
+class XmlParserBase {
 public:
     using attribute_list = std::vector<std::pair<std::string, std::string>>;
 
-    virtual ~XmlParser()  { }
-
-    // implement these methods when subclassing this parser
-    virtual void handle_starttag(std::string tag, const attribute_list& attrs) { }
-    virtual void handle_endtag(std::string tag) { }
-    virtual void handle_element(std::string tag, const attribute_list& attrs)
-    {
-        handle_starttag(tag, attrs);
-        handle_endtag(tag);
-    }
-    virtual void handle_xml_decl(std::string tag, const attribute_list& attrs) { }
-    virtual void handle_comment(const char*first, const char*last) { }
-    virtual void handle_data(const char*first, const char*last) { }
-
     enum {
         TOKEN_LESS_THEN,
         TOKEN_LT_QUESTION,
@@ -53,116 +53,64 @@ public:
         TOKEN_EQUALS,
         // note: no token for comment, cdata
     };
+    // tokens point into the buffer being parsed, NAME and STRING tokens have a non-empty range.
     struct Token {
-        virtual ~Token() { }
-        virtual int type() = 0;
-        virtual std::string name() const { return {}; }
-        virtual std::string value() const { return {}; }
-    };
-    struct LT_Token : Token {
-        int type() override { return TOKEN_LESS_THEN; }
-    };
-    struct LTQ_Token : Token {
-        int type() override { return TOKEN_LT_QUESTION; }
-    };
-    struct LTX_Token : Token {
-        int type() override { return TOKEN_LT_EXCLAMATION; }
-    };
-    struct LTS_Token : Token {
-        int type() override { return TOKEN_LT_SLASH; }
-    };
-
-//  struct GT_Token : Token {
-//      int type() override { return TOKEN_GREATER_THEN; }
-//  };
-//  struct SGT_Token : Token {
-//      int type() override { return TOKEN_SLASH_GT; }
-//  };
-//  struct QGT_Token : Token {
-//      int type() override { return TOKEN_QUESTION_GT; }
-//  };
-    struct NAME_Token : Token {
-        const char *first;
-        const char *last;
-
-        NAME_Token(const char *first, const char *last)
-            : first(first), last(last)
-        {
-        }
+        int type;
+        const char *first = nullptr;
+        const char *last = nullptr;
 
-        int type() override { return TOKEN_NAME; }
-
-        std::string name() const override { return {first, last}; }
+        std::string_view text() const { return std::string_view(first, last-first); }
+        std::string name() const { return std::string(first, last); }
+        std::string value() const { return std::string(first, last); }
     };
-    struct STRING_Token : Token {
-        const char *first;
-        const char *last;
-
-        STRING_Token(const char *first, const char *last)
-            : first(first), last(last)
-        {
-        }
 
-        int type() override { return TOKEN_STRING; }
-
-        std::string value() const override { return {first, last}; }
-    };
-    struct EQ_Token : Token {
-        int type() override { return TOKEN_EQUALS; }
-    };
-
-private:
-    std::vector<std::shared_ptr<Token>> _stack;
-public:
-    template<typename STR>
-    static std::string decode_entities(const STR& str)
-    {
-        // TODO  - decode entities
-        return str;
-    }
-    template<typename STR>
-    static std::string encode_entities(const STR& str)
+    /*
+     * Replaces &amp; &lt; &gt; &quot; &apos; and numeric character references with their
+     * utf-8 encoded value. Unknown or malformed references are kept as they are.
+     *
+     * Returns `str` itself when it contains no '&', otherwise a view on the decoded value,
+     * which is stored in `buf`. So the common case does not copy or allocate.
+     */
+    static std::string_view decode_entities(std::string_view str, std::string& buf);
+    static std::string decode_entities(std::string_view str)
     {
-        // TODO  - encode entities
-        return str;
+        std::string buf;
+        auto res = decode_entities(str, buf);
+        return res.data() == buf.data() ? buf : std::string(res);
     }
 
-    int stack_find(int token)
+    /*
+     * Escapes & < > and ", so the result can be used as data, and as a quoted attribute value.
+     * Returns `str` itself when nothing needs escaping, otherwise a view on `buf`.
+     */
+    static std::string_view encode_entities(std::string_view str, std::string& buf);
+    static std::string encode_entities(std::string_view str)
     {
-        int i = _stack.size()-1;
-        while (i>=0) {
-            if (_stack[i]->type() == token)
-                return i;
-        }
-        return -1;
+        std::string buf;
+        auto res = encode_entities(str, buf);
+        return res.data() == buf.data() ? buf : std::string(res);
     }
-    template<typename...ARGS>
-    bool stack_match(int token, ARGS...args)
-    {
-        if (_stack.size() < 1 + sizeof...(ARGS))
-            return false;
-        if (_stack[_stack.size()-1-sizeof...(ARGS)]->type() != token)
-            return false;
 
-        if constexpr (sizeof...(ARGS) != 0)
-            return stack_match(args...);
-        else
-            return true;
-    }
-    auto stack_pop_attr()
+    static void append_utf8(std::string& out, uint32_t c)
     {
-        attribute_list attrs;
-        while (stack_match(TOKEN_NAME, TOKEN_EQUALS, TOKEN_STRING)) {
-            auto value = _stack.back();
-            _stack.pop_back();
-            _stack.pop_back(); // '='
-            auto name = _stack.back();
-            _stack.pop_back();
-
-            attrs.emplace_back(std::string(name->name()), decode_entities(value->value()));
+        if (c < 0x80) {
+            out += char(c);
+        }
+        else if (c < 0x800) {
+            out += char(0xc0 | (c>>6));
+            out += char(0x80 | (c&0x3f));
+        }
+        else if (c < 0x10000) {
+            out += char(0xe0 | (c>>12));
+            out += char(0x80 | ((c>>6)&0x3f));
+            out += char(0x80 | (c&0x3f));
+        }
+        else {
+            out += char(0xf0 | (c>>18));
+            out += char(0x80 | ((c>>12)&0x3f));
+            out += char(0x80 | ((c>>6)&0x3f));
+            out += char(0x80 | (c&0x3f));
         }
-        std::reverse(attrs.begin(), attrs.end());
-        return attrs;
     }
 
     // NOTE: this needs to be a templated function, otherwise the
@@ -181,11 +129,11 @@ public:
         if (c <= 0x5e) return false;
         if (c == 0x60) return false;
         if (c <= 0x7a) return true;
-        if constexpr (std::is_unsigned_v<CHAR>) {
-            // NOTE: this should never happen for signed chars,
-            //   but somehow I keep getting a compiler warning for this line: always true.
-            if (c <= 0x7f) return false;
-        }
+        // 7b-7f: for signed chars the values above 7f were handled above.
+        if constexpr (std::is_signed_v<CHAR>)
+            return false;
+        else if (c <= 0x7f)
+            return false;
 
         // note: not following xml spec exactly, 
         // also unicode 80-b6, b8-bf, d7, f7, 37e, 2000-200b, 200e-203e,
@@ -205,11 +153,338 @@ public:
         }
         return false;
     }
+};
+
+/*
+ * Locates the characters the tokenizer looks for with SSE2 compares, 16 bytes at a time.
+ * `index` works like simdjson's stage 1: for each 64 byte block a bitmask is computed,
+ * bit i is set when byte i is a structural character.
+ * The remaining bytes, or all bytes without SSE2, are checked one at a time.
+ *
+ * The tokenizer does not use `index`: a complete index costs more than searching
+ * for the next interesting character, since most tokens are short, and the find_xxx
+ * searches stop at the first match. `index` is kept for callers which need all positions.
+ */
+struct xmlscan {
+    // xml whitespace: space, tab, newline and carriage return.
+    static bool isspace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+    static bool isstructural(char c) { return c == '<' || c == '>' || c == '"' || c == '\'' || c == '=' || isspace(c); }
+    // the characters escaped by encode_entities
+    static bool isspecial(char c) { return c == '&' || c == '<' || c == '>' || c == '"'; }
+
+#ifdef XMLSCAN_SSE2
+    static __m128i eq(__m128i v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+    // lo <= v <= hi, for 0 < lo <= hi < 0x7f ; bytes >= 0x80 compare as negative.
+    static __m128i inrange(__m128i v, char lo, char hi) { return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo-1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi+1))); }
+
+    static __m128i space(__m128i v) { return _mm_or_si128(_mm_or_si128(eq(v, ' '), eq(v, '\t')), _mm_or_si128(eq(v, '\n'), eq(v, '\r'))); }
+    static __m128i structural(__m128i v)
+    {
+        auto m = _mm_or_si128(eq(v, '<'), eq(v, '>'));
+        m = _mm_or_si128(m, _mm_or_si128(eq(v, '"'), eq(v, '\'')));
+        return _mm_or_si128(m, _mm_or_si128(eq(v, '='), space(v)));
+    }
+    static __m128i special(__m128i v)
+    {
+        return _mm_or_si128(_mm_or_si128(eq(v, '&'), eq(v, '<')), _mm_or_si128(eq(v, '>'), eq(v, '"')));
+    }
+    // the complement of XmlParserBase::isnamechar
+    static __m128i nonname(__m128i v)
+    {
+        auto ascii = _mm_cmpgt_epi8(v, _mm_set1_epi8(-1));
+        auto m = _mm_and_si128(ascii, _mm_cmplt_epi8(v, _mm_set1_epi8(0x2d)));   // 00-2c
+        m = _mm_or_si128(m, eq(v, 0x2f));
+        m = _mm_or_si128(m, inrange(v, 0x3b, 0x40));
+        m = _mm_or_si128(m, inrange(v, 0x5b, 0x5e));
+        m = _mm_or_si128(m, eq(v, 0x60));
+        return _mm_or_si128(m, _mm_cmpgt_epi8(v, _mm_set1_epi8(0x7a)));         // 7b-7f
+    }
+
+    // combines the results for 4 x 16 bytes into one 64 bit mask.
+    template<typename FN>
+    static uint64_t blockmask(const char *p, FN fn)
+    {
+        uint64_t m = 0;
+        for (int i = 0 ; i < 4 ; i++) {
+            auto v = _mm_loadu_si128((const __m128i*)(p + 16*i));
+            m |= uint64_t(uint32_t(_mm_movemask_epi8(fn(v)))) << (16*i);
+        }
+        return m;
+    }
+    // searching stops at the first 16 byte vector with a match.
+    template<typename FN>
+    static const char *findblock(const char *&p, const char *last, FN fn)
+    {
+        while (last - p >= 16) {
+            if (unsigned m = _mm_movemask_epi8(fn(_mm_loadu_si128((const __m128i*)p))))
+                return p + std::countr_zero(m);
+            p += 16;
+        }
+        return nullptr;
+    }
+#define XMLSCAN_BLOCKS(p, last, fn)  if (auto r = findblock(p, last, fn)) return r;
+#else
+#define XMLSCAN_BLOCKS(p, last, fn)
+#endif
+
+    static const char *find_char(const char *p, const char *last, char c)
+    {
+        XMLSCAN_BLOCKS(p, last, [c](auto v) { return eq(v, c); })
+        return std::find(p, last, c);
+    }
+    static const char *find_nonspace(const char *p, const char *last)
+    {
+        // whitespace runs are usually short.
+        if (p < last && !isspace(*p))
+            return p;
+        XMLSCAN_BLOCKS(p, last, [](auto v) { return _mm_xor_si128(space(v), _mm_set1_epi8(-1)); })
+        return std::find_if(p, last, [](char c) { return !isspace(c); });
+    }
+    static const char *find_nonname(const char *p, const char *last)
+    {
+        XMLSCAN_BLOCKS(p, last, nonname)
+        return std::find_if(p, last, [](char c) { return !XmlParserBase::isnamechar(c); });
+    }
+    static const char *find_structural(const char *p, const char *last)
+    {
+        XMLSCAN_BLOCKS(p, last, structural)
+        return std::find_if(p, last, isstructural);
+    }
+    static const char *find_special(const char *p, const char *last)
+    {
+        XMLSCAN_BLOCKS(p, last, special)
+        return std::find_if(p, last, isspecial);
+    }
+    static const char *find_str(const char *p, const char *last, std::string_view str)
+    {
+        while (true) {
+            p = find_char(p, last, str[0]);
+            if (size_t(last - p) < str.size())
+                return last;
+            if (std::equal(str.begin(), str.end(), p))
+                return p;
+            ++p;
+        }
+    }
+    // appends the offsets of all structural characters: < > " ' = and whitespace.
+    static void index(const char *first, const char *last, std::vector<uint32_t>& positions)
+    {
+        const char *p = first;
+#ifdef XMLSCAN_SSE2
+        for ( ; last - p >= 64 ; p += 64) {
+            uint64_t m = blockmask(p, structural);
+            while (m) {
+                positions.push_back(uint32_t(p - first + std::countr_zero(m)));
+                m &= m - 1;
+            }
+        }
+#endif
+        for ( ; p < last ; ++p)
+            if (isstructural(*p))
+                positions.push_back(uint32_t(p - first));
+    }
+};
+#undef XMLSCAN_BLOCKS
+
+inline std::string_view XmlParserBase::decode_entities(std::string_view str, std::string& buf)
+{
+    const char *first = str.data();
+    const char *last = first + str.size();
+    const char *p = xmlscan::find_char(first, last, '&');
+    if (p == last)
+        return str;
+
+    auto decode = [](std::string_view ent) -> int32_t {
+        if (ent == "amp") return '&';
+        if (ent == "lt") return '<';
+        if (ent == "gt") return '>';
+        if (ent == "quot") return '"';
+        if (ent == "apos") return '\'';
+        if (ent.size() < 2 || ent[0] != '#')
+            return -1;
+        int base = 10;
+        ent.remove_prefix(1);
+        if (ent[0] == 'x' || ent[0] == 'X') {
+            base = 16;
+            ent.remove_prefix(1);
+        }
+        if (ent.empty())
+            return -1;
+        uint32_t c = 0;
+        for (char ch : ent) {
+            int d;
+            if (ch >= '0' && ch <= '9') d = ch - '0';
+            else if (base == 16 && ch >= 'a' && ch <= 'f') d = ch - 'a' + 10;
+            else if (base == 16 && ch >= 'A' && ch <= 'F') d = ch - 'A' + 10;
+            else return -1;
+            c = c * base + d;
+            if (c > 0x10ffff)
+                return -1;
+        }
+        // nul and utf-16 surrogates are not valid characters.
+        if (c == 0 || (c >= 0xd800 && c < 0xe000))
+            return -1;
+        return c;
+    };
+
+    buf.assign(first, p);
+    while (p < last) {
+        // p points to a '&'
+        // only look a limited distance for the ';', numeric references may have leading zeros.
+        auto end = last - p > 32 ? p + 32 : last;
+        auto semi = std::find(p + 1, end, ';');
+        int32_t c = semi == end ? -1 : decode(std::string_view(p + 1, semi - p - 1));
+        if (c < 0) {
+            buf += '&';
+            p++;
+        }
+        else {
+            append_utf8(buf, c);
+            p = semi + 1;
+        }
+        auto q = xmlscan::find_char(p, last, '&');
+        buf.append(p, q);
+        p = q;
+    }
+    return buf;
+}
+
+inline std::string_view XmlParserBase::encode_entities(std::string_view str, std::string& buf)
+{
+    const char *first = str.data();
+    const char *last = first + str.size();
+    const char *p = xmlscan::find_special(first, last);
+    if (p == last)
+        return str;
+
+    buf.assign(first, p);
+    while (p < last) {
+        switch (*p) {
+            case '&': buf += "&amp;"; break;
+            case '<': buf += "&lt;"; break;
+            case '>': buf += "&gt;"; break;
+            case '"': buf += "&quot;"; break;
+        }
+        auto q = xmlscan::find_special(p + 1, last);
+        buf.append(p + 1, q);
+        p = q;
+    }
+    return buf;
+}
+
+// an attribute as found in the source, the value is only decoded when asked for.
+struct XmlAttribute {
+    std::string_view name;
+    std::string_view raw;      // the value, without quotes, with entities still encoded
+
+    std::string value() const { return XmlParserBase::decode_entities(raw); }
+    // `raw` itself when there are no entities, otherwise the decoded value, stored in `buf`.
+    std::string_view value(std::string& buf) const { return XmlParserBase::decode_entities(raw, buf); }
+};
+
+// the attributes of a tag, only valid during the handler call.
+class XmlAttributeView {
+    std::span<const XmlAttribute> _attrs;
+public:
+    XmlAttributeView(std::span<const XmlAttribute> attrs)
+        : _attrs(attrs)
+    {
+    }
+    auto begin() const { return _attrs.begin(); }
+    auto end() const { return _attrs.end(); }
+    size_t size() const { return _attrs.size(); }
+    bool empty() const { return _attrs.empty(); }
+    const XmlAttribute& operator[](size_t i) const { return _attrs[i]; }
+
+    const XmlAttribute *find(std::string_view name) const
+    {
+        for (auto& a : _attrs)
+            if (a.name == name)
+                return &a;
+        return nullptr;
+    }
+    bool has(std::string_view name) const { return find(name) != nullptr; }
+    // the decoded value, or an empty string when the attribute is not present.
+    std::string get(std::string_view name) const
+    {
+        auto a = find(name);
+        return a ? a->value() : std::string();
+    }
+    // owned copies of all attributes, with decoded values.
+    XmlParserBase::attribute_list list() const
+    {
+        XmlParserBase::attribute_list attrs;
+        attrs.reserve(_attrs.size());
+        for (auto& a : _attrs)
+            attrs.emplace_back(std::string(a.name), a.value());
+        return attrs;
+    }
+};
+
+/*
+ * The parser core, calls the handlers of DERIVED without virtual dispatch:
+ *
+ *   struct Counter : XmlSaxParser<Counter> {
+ *       int n = 0;
+ *       void on_starttag(std::string_view tag, const XmlAttributeView& attrs) { n++; }
+ *   };
+ *
+ * Handlers which are not implemented by DERIVED default to the empty ones below.
+ * The string_views point into the buffer passed to `parse`.
+ */
+template<typename DERIVED>
+class XmlSaxParser : public XmlParserBase {
+    // both vectors are reused, so no allocations are needed after the first few tags.
+    std::vector<Token> _stack;
+    std::vector<XmlAttribute> _attrs;
+    std::string _carry;     // the unparsed end of the previous chunk
+    size_t _resume = 0;     // offset in _carry where the search for the end of a comment or cdata continues
+
+    DERIVED& derived() { return static_cast<DERIVED&>(*this); }
+public:
+    void on_starttag(std::string_view tag, const XmlAttributeView& attrs) { }
+    void on_endtag(std::string_view tag) { }
+    void on_element(std::string_view tag, const XmlAttributeView& attrs)
+    {
+        derived().on_starttag(tag, attrs);
+        derived().on_endtag(tag);
+    }
+    void on_xml_decl(std::string_view tag, const XmlAttributeView& attrs) { }
+    void on_comment(std::string_view text) { }
+    void on_data(std::string_view text) { }
+
+    template<typename...ARGS>
+    bool stack_match(int token, ARGS...args)
+    {
+        if (_stack.size() < 1 + sizeof...(ARGS))
+            return false;
+        if (_stack[_stack.size()-1-sizeof...(ARGS)].type != token)
+            return false;
+
+        if constexpr (sizeof...(ARGS) != 0)
+            return stack_match(args...);
+        else
+            return true;
+    }
+    // pops the trailing  NAME = STRING  triples from the stack, the result refers to the parsed buffer.
+    const std::vector<XmlAttribute>& stack_pop_attr()
+    {
+        _attrs.clear();
+        while (stack_match(TOKEN_NAME, TOKEN_EQUALS, TOKEN_STRING)) {
+            auto value = _stack.back().text();
+            auto name = _stack[_stack.size()-3].text();
+            _stack.resize(_stack.size()-3);
+
+            _attrs.push_back(XmlAttribute{name, value});
+        }
+        std::reverse(_attrs.begin(), _attrs.end());
+        return _attrs;
+    }
     int most_recent_open_token()
     {
         for (auto i = _stack.rbegin() ; i != _stack.rend() ; ++i)
-            if (is_open_token((*i)->type()))
-                return (*i)->type();
+            if (is_open_token(i->type))
+                return i->type;
         return -1;
     }
 public:
@@ -218,106 +493,207 @@ public:
     {
         parse((const char*)&str[0], (const char*)&str[0] + str.size());
     }
+    // parse a complete document, or a sequence of complete tags.
+    // throws when the input ends inside a tag.
     void parse(const char*first, const char*last)
+    {
+        try {
+            parsechunk(first, last, false);
+        }
+        catch (...) {
+            _stack.clear();
+            throw;
+        }
+    }
+
+    /*
+     * Streaming interface, for documents which don't fit in memory:
+     *
+     *   while ((n = f.read(buf, size)))
+     *       p.feed(buf, buf+n);
+     *   p.finish();
+     *
+     * A tag, comment or cdata section which is cut off at the end of a chunk is
+     * kept, and parsed again when the next chunk arrives. So memory use depends on the
+     * largest tag, not on the document size. Text data may be reported in several pieces.
+     * The search for the end of a long comment or cdata section continues where the
+     * previous chunk ended, instead of rescanning it for every chunk.
+     */
+    template<typename STR>
+    void feed(const STR& str)
+    {
+        feed((const char*)&str[0], (const char*)&str[0] + str.size());
+    }
+    void feed(const char*first, const char*last)
+    {
+        if (_carry.empty()) {
+            auto rest = parsechunk(first, last, true, 0);
+            _carry.assign(rest, last);
+        }
+        else {
+            _carry.append(first, last);
+            auto rest = parsechunk(_carry.data(), _carry.data() + _carry.size(), true, _resume);
+            _carry.erase(0, rest - _carry.data());
+        }
+    }
+    // feeds chunks obtained from read(char*buf, size_t size) -> size_t, until it returns 0.
+    template<typename READ>
+    void feedall(READ read, size_t chunksize = 0x10000)
+    {
+        std::vector<char> buf(chunksize);
+        while (size_t n = read(buf.data(), buf.size()))
+            feed(buf.data(), buf.data() + n);
+    }
+    // call after the last chunk, throws when the document ends inside a tag.
+    void finish()
+    {
+        std::string rest;
+        std::swap(rest, _carry);
+        try {
+            if (!rest.empty())
+                parsechunk(rest.data(), rest.data() + rest.size(), false);
+        }
+        catch (...) {
+            _stack.clear();
+            throw;
+        }
+        if (!_stack.empty()) {
+            _stack.clear();
+            throw std::runtime_error("invalid xml: incomplete document");
+        }
+        _resume = 0;
+    }
+
+private:
+    // with `streaming`, an incomplete construct at the end is not an error, but the position
+    // where it starts is returned, so it can be parsed again when more data is available.
+    // When the chunk starts with a comment or cdata section, the search for its end starts at first+resume.
+    const char *parsechunk(const char*first, const char*last, bool streaming, size_t resume = 0)
     {
         const char *p = first;
         const char *q = last;
+        const char *tagstart = first;   // the '<' of the current tag
+        _resume = 0;
+        auto incomplete = [&](const char *msg) {
+            if (!streaming)
+                throw std::runtime_error(msg);
+            _stack.clear();
+            return tagstart;
+        };
+        // search for the end of a comment or cdata section starting at q.
+        auto findend = [&](std::string_view end) {
+            auto from = tagstart == first ? std::max(q, first + resume) : q;
+            auto e = xmlscan::find_str(from, last, end);
+            if (e == last) {
+                // the terminator may be split over this chunk and the next.
+                _resume = std::max(q, last - (end.size() - 1)) - tagstart;
+            }
+            return e;
+        };
+        // true when [q, last) may be the start of `str`, but is too short to tell.
+        auto maybeprefix = [&](std::string_view str, size_t needed) {
+            size_t avail = last - q;
+            return avail < needed && std::equal(q, q + std::min(avail, str.size()), str.begin());
+        };
         while (p < last) {
             if (_stack.empty()) {
                 // currently not inside a tag.
 
-                q = std::find(p, last, '<');
+                q = xmlscan::find_char(p, last, '<');
                 if (q == last) {
-                    handle_data(p, last);
+                    derived().on_data(std::string_view(p, last-p));
                     break;
                 }
                 if (p < q)
-                    handle_data(p, q);
+                    derived().on_data(std::string_view(p, q-p));
 
+                tagstart = q;
                 ++q;
                 if (q == last)
-                    throw std::runtime_error("invalid xml#0");
+                    return incomplete("invalid xml#0");
+                if (streaming && (maybeprefix("!--", 3) || maybeprefix("![CDATA[", 9)))
+                    return tagstart;
                 if (*q == '?') {
                     // <?  name  attr  ?>
-                    _stack.push_back(std::make_shared<LTQ_Token>());
+                    _stack.push_back(Token{TOKEN_LT_QUESTION});
                     ++q;
                 }
                 else if (*q == '!') {
                     if (q+2 < last && q[1]=='-' && q[2] == '-') {
                         // <!--  ... -->
                         q += 3;
-                        const char *ecmt = "-->";
-                        auto e = std::search(q, last, ecmt, ecmt+3);
+                        auto e = findend("-->");
                         if (e==last)
-                            throw std::runtime_error("invalid xml#1");
-                        handle_comment(q, e);
+                            return incomplete("invalid xml#1");
+                        derived().on_comment(std::string_view(q, e-q));
                         q = e+3;
                     }
                     else if (q+8 < last && std::equal(q, q+8, "![CDATA[")) {
                         // <![CDATA[ ... ]]>
                         q += 8;
-                        const char *ecmt = "]]>";
-                        auto e = std::search(q, last, ecmt, ecmt+3);
+                        auto e = findend("]]>");
                         if (e==last)
-                            throw std::runtime_error("invalid xml#2");
-                        handle_data(q, e);
+                            return incomplete("invalid xml#2");
+                        derived().on_data(std::string_view(q, e-q));
                         q = e+3;
                     }
                     else {
                         // <! KEYWORD
-                        _stack.push_back(std::make_shared<LTX_Token>());
+                        _stack.push_back(Token{TOKEN_LT_EXCLAMATION});
                         ++q;
                     }
                 }
                 else if (*q == '/') {
                     //  </  name >
-                    _stack.push_back(std::make_shared<LTS_Token>());
+                    _stack.push_back(Token{TOKEN_LT_SLASH});
                     ++q;
                 }
                 else {
                     // <  name ...
-                    _stack.push_back(std::make_shared<LT_Token>());
+                    _stack.push_back(Token{TOKEN_LESS_THEN});
                 }
             }
             else {  // inside a tag
 
                 // skip whitespace
-                q = std::find_if(p, last, [](char c) { return !isspace(c); });
+                q = xmlscan::find_nonspace(p, last);
                 if (q==last)
-                    throw std::runtime_error("invalid xml#3");
+                    return incomplete("invalid xml#3");
                 char c = *q++;
+                if (streaming && q == last && (c == '/' || c == '?'))
+                    return incomplete("");
                 if (c == '"' || c=='\'') {
                     // string
-                    auto e = std::find(q, last, c);
+                    auto e = xmlscan::find_char(q, last, c);
                     if (e==last)
-                        throw std::runtime_error("invalid xml#4");
-                    _stack.push_back(std::make_shared<STRING_Token>(q, e));
+                        return incomplete("invalid xml#4");
+                    _stack.push_back(Token{TOKEN_STRING, q, e});
                     q = e+1;
                 }
                 else if (c == '/' && q < last && *q == '>') {
                     // <  name  k=v ... />
                     ++q;
                     // stack: LT_Token + NAME_Token + [ NAME = STRING ]* + SGT
-                    auto attrs = stack_pop_attr();
+                    auto& attrs = stack_pop_attr();
                     if (!stack_match(TOKEN_LESS_THEN, TOKEN_NAME))
                         throw std::runtime_error("invalid xml#5");
                     auto tagname = _stack.back();
                     _stack.pop_back();
                     _stack.pop_back();  // '<'
 
-                    handle_element(tagname->name(), attrs);
+                    derived().on_element(tagname.text(), XmlAttributeView(attrs));
                 }
                 else if (c == '?' && q < last && *q == '>') {
                     // <?  ...  ?>
                     ++q;
-                    auto attrs = stack_pop_attr();
+                    auto& attrs = stack_pop_attr();
                     if (!stack_match(TOKEN_LT_QUESTION, TOKEN_NAME))
                         throw std::runtime_error("invalid xml#6");
                     auto tagname = _stack.back();
                     _stack.pop_back();
                     _stack.pop_back();  // '<?'
 
-                    handle_xml_decl(tagname->name(), attrs);
+                    derived().on_xml_decl(tagname.text(), XmlAttributeView(attrs));
                 }
                 else if (c == '>') {
                     if (stack_match(TOKEN_LT_SLASH, TOKEN_NAME)) {
@@ -326,22 +702,22 @@ public:
                         _stack.pop_back();
                         _stack.pop_back();  // '</'
 
-                        handle_endtag(tagname->name());
+                        derived().on_endtag(tagname.text());
                     }
                     else if (most_recent_open_token() == TOKEN_LESS_THEN) {
                         // < name k=v ... >
-                        auto attrs = stack_pop_attr();
+                        auto& attrs = stack_pop_attr();
                         if (!stack_match(TOKEN_LESS_THEN, TOKEN_NAME)) 
                             throw std::runtime_error("invalid xml#7");
                         auto tagname = _stack.back();
                         _stack.pop_back();
                         _stack.pop_back();  // '<'
 
-                        handle_starttag(tagname->name(), attrs);
+                        derived().on_starttag(tagname.text(), XmlAttributeView(attrs));
                     }
                     else {
                         // discard  !DOCTYPE stuff.
-                        while (!_stack.empty() && _stack.back()->type() != TOKEN_LT_EXCLAMATION)
+                        while (!_stack.empty() && _stack.back().type != TOKEN_LT_EXCLAMATION)
                             _stack.pop_back();
 
                         if (_stack.empty())
@@ -350,13 +726,13 @@ public:
                     }
                 }
                 else if (c == '=') {
-                    _stack.push_back(std::make_shared<EQ_Token>());
+                    _stack.push_back(Token{TOKEN_EQUALS});
                 }
                 else if (isnamechar(c)) {
-                    auto e = std::find_if(q, last, [](auto c){ return !XmlParser::isnamechar(c); });
+                    auto e = xmlscan::find_nonname(q, last);
                     if (e==last)
-                        throw std::runtime_error("invalid xml#9");
-                    _stack.push_back(std::make_shared<NAME_Token>(q-1, e));
+                        return incomplete("invalid xml#9");
+                    _stack.push_back(Token{TOKEN_NAME, q-1, e});
 
                     q = e;
                 }
@@ -366,5 +742,36 @@ public:
             }
             p = q;
         }
+        if (!_stack.empty())
+            return incomplete("invalid xml: incomplete document");
+        return last;
+    }
+};
+
+/*
+ * Parser with virtual handlers, subclass this and override the handle_xxx methods.
+ */
+class XmlParser : public XmlSaxParser<XmlParser> {
+public:
+    virtual ~XmlParser()  { }
+
+    // implement these methods when subclassing this parser
+    virtual void handle_starttag(std::string tag, const attribute_list& attrs) { }
+    virtual void handle_endtag(std::string tag) { }
+    virtual void handle_element(std::string tag, const attribute_list& attrs)
+    {
+        handle_starttag(tag, attrs);
+        handle_endtag(tag);
     }
+    virtual void handle_xml_decl(std::string tag, const attribute_list& attrs) { }
+    virtual void handle_comment(const char*first, const char*last) { }
+    virtual void handle_data(const char*first, const char*last) { }
+
+    // the XmlSaxParser handlers, forwarding to the virtual handlers.
+    void on_starttag(std::string_view tag, const XmlAttributeView& attrs) { handle_starttag(std::string(tag), attrs.list()); }
+    void on_endtag(std::string_view tag) { handle_endtag(std::string(tag)); }
+    void on_element(std::string_view tag, const XmlAttributeView& attrs) { handle_element(std::string(tag), attrs.list()); }
+    void on_xml_decl(std::string_view tag, const XmlAttributeView& attrs) { handle_xml_decl(std::string(tag), attrs.list()); }
+    void on_comment(std::string_view text) { handle_comment(text.data(), text.data() + text.size()); }
+    void on_data(std::string_view text) { handle_data(text.data(), text.data() + text.size()); }
 };
@@ -0,0 +1,142 @@
+#include "unittestframework.h"
+
+#include <cpputils/asyncio.h>
+#include <cpputils/asyncio.h>
+
+#include <stdlib.h>
+#include <vector>
+#include <numeric>
+
+static filehandle maketempfile(size_t size)
+{
+    char name[] = "/tmp/asyncio-XXXXXX";
+    filehandle f = mkstemp(name);
+    ::unlink(name);
+
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0 ; i < size ; i++)
+        data[i] = i*7;
+    f.write(data.data(), data.size());
+    return f;
+}
+
+static void testbackend(asyncio::Backend backend)
+{
+    const size_t blocksize = 512;
+    const int nblocks = 100;
+    auto f = maketempfile(blocksize * nblocks);
+
+    asyncio aio(8, backend);
+
+    SECTION("callbacks") {
+        std::vector<std::vector<uint8_t>> bufs(nblocks, std::vector<uint8_t>(blocksize));
+        std::vector<int64_t> results(nblocks, -1);
+        for (int i = 0 ; i < nblocks ; i++) {
+            int ix = nblocks-1-i;
+            aio.pread(f, ix*blocksize, bufs[ix].data(), blocksize, [&results, ix](int64_t res) { results[ix] = res; });
+        }
+        CHECK(aio.inflight() == 0);
+        aio.submit();
+        CHECK(aio.inflight() == nblocks);
+        aio.wait();
+        CHECK(aio.inflight() == 0);
+
+        for (int i = 0 ; i < nblocks ; i++) {
+            CHECK(results[i] == blocksize);
+            CHECK(bufs[i][3] == uint8_t((i*blocksize+3)*7));
+        }
+    }
+    SECTION("futures") {
+        std::vector<uint8_t> wbuf(100, 0xAA);
+        auto w = aio.pwrite(f, 10, wbuf.data(), wbuf.size());
+        aio.submit();
+        aio.wait();
+        CHECK(w.get() == 100);
+
+        std::vector<uint8_t> rbuf(200);
+        auto r = aio.pread(f, 0, rbuf.data(), rbuf.size());
+        // reading past the end returns 0
+        std::vector<uint8_t> ebuf(10);
+        auto e = aio.pread(f, blocksize*nblocks, ebuf.data(), ebuf.size());
+        aio.submit();
+        while (aio.inflight())
+            aio.poll();
+        CHECK(r.get() == 200);
+        CHECK(e.get() == 0);
+        CHECK(rbuf[9] == uint8_t(9*7));
+        CHECK(rbuf[10] == 0xAA);
+        CHECK(rbuf[109] == 0xAA);
+        CHECK(rbuf[110] == uint8_t(110*7));
+    }
+    SECTION("errors") {
+        int fpair[2];
+        ::pipe(fpair);
+        filehandle wr = fpair[1];
+        filehandle rd = fpair[0];
+
+        // reading from the write end of a pipe fails
+        uint8_t buf[4];
+        auto r = aio.pread(wr, 0, buf, 4);
+        // no filehandle
+        int64_t cbresult = 0;
+        aio.pread(filehandle{}, 0, buf, 4, [&cbresult](int64_t res) { cbresult = res; });
+        aio.submit();
+        aio.wait();
+        CHECK_THROWS_AS(r.get(), std::system_error);
+        CHECK(cbresult == -EBADF);
+    }
+    SECTION("throwing-callback") {
+        // all completions are reported, then the first exception is rethrown.
+        std::vector<uint8_t> buf(blocksize);
+        int called = 0;
+        for (int i = 0 ; i < 4 ; i++)
+            aio.pread(f, i*blocksize, buf.data(), blocksize, [&called](int64_t) { called++; throw std::runtime_error("cb"); });
+        aio.submit();
+        while (aio.inflight())
+            CHECK_THROWS_AS(aio.waitsome(), std::runtime_error);
+        CHECK(called == 4);
+    }
+    SECTION("destroy-after-throwing-callback") {
+        // the destructor reports all requests, even when callbacks throw.
+        std::vector<std::vector<uint8_t>> bufs(nblocks, std::vector<uint8_t>(blocksize));
+        int called = 0;
+        {
+            asyncio aio2(8, backend);
+            for (int i = 0 ; i < nblocks ; i++)
+                aio2.pread(f, i*blocksize, bufs[i].data(), blocksize, [&called](int64_t) { called++; throw std::runtime_error("cb"); });
+            aio2.submit();
+        }
+        CHECK(called == nblocks);
+    }
+    SECTION("toolarge") {
+        uint8_t buf[4];
+        CHECK_THROWS(aio.pread(f, 0, buf, size_t(1)<<32, [](int64_t) { }));
+        CHECK_THROWS(aio.pwrite(f, 0, buf, asyncio::maxcount + 1));
+        CHECK(aio.inflight() == 0);
+    }
+    SECTION("resubmit") {
+        // callbacks can queue new requests
+        std::vector<uint8_t> buf(blocksize);
+        int count = 0;
+        std::function<void(int64_t)> next = [&](int64_t res) {
+            CHECK(res == blocksize);
+            if (++count < 10) {
+                aio.pread(f, count*blocksize, buf.data(), blocksize, next);
+                aio.submit();
+            }
+        };
+        aio.pread(f, 0, buf.data(), blocksize, next);
+        aio.submit();
+        aio.wait();
+        CHECK(count == 10);
+    }
+}
+
+TEST_CASE("asyncio") {
+    SECTION("threads") {
+        testbackend(asyncio::THREADS);
+    }
+    SECTION("auto") {
+        testbackend(asyncio::AUTO);
+    }
+}
@@ -0,0 +1,160 @@
+#include "unittestframework.h"
+
+#include <cpputils/bufferedfile.h>
+#include <cpputils/bufferedfile.h>
+#include <cpputils/formatter.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static filehandle maketempfile(const std::string& data)
+{
+    char name[] = "/tmp/bufferedfile-XXXXXX";
+    filehandle f = mkstemp(name);
+    ::unlink(name);
+    f.write((const uint8_t*)data.data(), data.size());
+    f.seek(0);
+    return f;
+}
+
+TEST_CASE("bufferedreader") {
+    SECTION("readline") {
+        auto f = maketempfile("first\nsecond line\n\nlast");
+        bufferedreader r(f, 16);
+        std::string line;
+        CHECK(r.readline(line));
+        CHECK(line == "first");
+        CHECK(r.readline(line));
+        CHECK(line == "second line");
+        CHECK(r.readline(line));
+        CHECK(line == "");
+        CHECK(r.readline(line));
+        CHECK(line == "last");
+        CHECK(!r.readline(line));
+        CHECK(r.eof());
+    }
+    SECTION("peek") {
+        auto f = maketempfile("0123456789abcdefghijklmnopqrstuvwxyz");
+        bufferedreader r(f, 16);
+        auto s = r.peek(4);
+        REQUIRE(s.size() == 4);
+        CHECK(s[0] == '0');
+
+        // peek larger than the buffer grows it
+        s = r.peek(30);
+        REQUIRE(s.size() == 30);
+        CHECK(s[29] == 't');
+        CHECK(r.tell() == 0);
+
+        r.skip(10);
+        CHECK(r.tell() == 10);
+        s = r.peek(100);
+        CHECK(s.size() == 26);
+        CHECK(s[0] == 'a');
+    }
+    SECTION("read") {
+        std::string data;
+        for (int i = 0 ; i < 1000 ; i++)
+            data += char('a' + i%26);
+        auto f = maketempfile(data);
+        bufferedreader r(f, 64);
+
+        uint8_t buf[200];
+        r.read_exact(buf, 3);
+        CHECK(buf[2] == 'c');
+        // larger than the buffer
+        r.read_exact(buf, 200);
+        CHECK(buf[0] == 'd');
+        CHECK(buf[199] == 'a' + 202%26);
+        r.skip(500);
+        CHECK(r.tell() == 703);
+        auto v = r.read_exact(297);
+        CHECK(v.back() == 'a' + 999%26);
+        CHECK(r.read(buf, 10) == 0);
+        CHECK_THROWS(r.read_exact(buf, 1));
+        CHECK_THROWS(r.skip(1));
+    }
+    SECTION("unpacker") {
+        auto f = maketempfile(std::string("\x01\x02\x03\x04\x05\x06\x07\x08\x96\x01" "abc", 13));
+        bufferedreader r(f, 16);
+        unpacker u(r.begin(), r.end());
+        CHECK(u.get16le() == 0x0201);
+        CHECK(u.get16be() == 0x0304);
+        u.skip(1);
+        CHECK(u.get24be() == 0x060708);
+        CHECK(u.getvarint() == 150);
+
+        auto v = r.getunpacker(3);
+        CHECK(v.getstr(3) == "abc");
+        CHECK(r.eof());
+        CHECK(u.eof());
+        CHECK_THROWS(u.get8());
+    }
+}
+
+TEST_CASE("bufferedwriter") {
+    char name[] = "/tmp/bufferedfile-XXXXXX";
+    filehandle f = mkstemp(name);
+    ::unlink(name);
+
+    SECTION("write") {
+        {
+            bufferedwriter w(f, 16);
+            w.write("abc", 3);
+            CHECK(w.buffered() == 3);
+            w.write(std::string(100, 'x'));
+            CHECK(w.buffered() == 0);
+            w.write(std::vector<uint8_t>{ 'y', 'z' });
+            packer p(w.inserter(), w.inserter());
+            p.set32be(0x31323334);
+            p.setvarint(300);
+            // flushed by the destructor
+        }
+        f.seek(0);
+        bufferedreader r(f);
+        std::vector<uint8_t> data(200);
+        data.resize(r.read(data.data(), data.size()));
+        REQUIRE(data.size() == 3+100+2+4+2);
+        CHECK(data[0] == 'a');
+        CHECK(data[3] == 'x');
+        CHECK(data[102] == 'x');
+        CHECK(data[103] == 'y');
+        CHECK(data[105] == '1');
+        CHECK(data[109] == 0xac);
+        CHECK(data[110] == 0x02);
+    }
+    SECTION("many") {
+        bufferedwriter w(f, 64);
+        for (int i = 0 ; i < 1000 ; i++)
+            w.put(i);
+        w.flush();
+        CHECK(w.buffered() == 0);
+        CHECK(f.size() == 1000);
+    }
+    SECTION("flush-error") {
+        // writing to a read only handle fails, the data stays buffered.
+        filehandle ro(::open("/dev/null", O_RDONLY));
+        bufferedwriter w(ro, 64);
+        w.write("abc", 3);
+        CHECK_THROWS(w.flush());
+        CHECK(w.buffered() == 3);
+        CHECK_THROWS(w.write(std::string(100, 'x')));
+        CHECK(w.buffered() == 3);
+    }
+    SECTION("fprint") {
+        {
+            bufferedwriter w(f);
+            for (int i = 0 ; i < 3 ; i++)
+                fprint(w, "line %d\n", i);
+        }
+        f.seek(0);
+        bufferedreader r(f);
+        std::string line;
+        CHECK(r.readline(line));
+        CHECK(line == "line 0");
+        CHECK(r.readline(line));
+        CHECK(r.readline(line));
+        CHECK(line == "line 2");
+        CHECK(!r.readline(line));
+    }
+}
@@ -1,5 +1,6 @@
 #include "unittestframework.h"
 #include <vector>
+#include <string>
 
 // include twice to detect proper header behaviour
 #include <cpputils/crccalc.h>
@@ -57,5 +58,18 @@ TEST_SUITE("crc16") {
         CHECK( crc24_1(v33.data(), v33.size()) == 0x17F224B );
         CHECK( crc24_2(v33.data(), v33.size()) == 0x0A38C2A );
     }
-}
+    TEST_CASE("crc64") {
+        std::string check = "123456789";
+        CHECK( crc64((const uint8_t*)check.data(), check.size()) == 0x995DC9BBDF1939FA );
+        CHECK( crc32((const uint8_t*)check.data(), check.size()) == 0xCBF43926 );
+
+        // incremental
+        uint64_t crc = ~uint64_t(0);
+        crc = crc64(crc, (const uint8_t*)check.data(), 4);
+        crc = crc64(crc, (const uint8_t*)check.data()+4, 5);
+        CHECK( (crc ^ ~uint64_t(0)) == 0x995DC9BBDF1939FA );
 
+        std::vector<uint8_t> v22(33, 0x22);
+        CHECK( crc64(v22) == crc64(v22.data(), v22.size()) );
+    }
+}
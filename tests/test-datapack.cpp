@@ -1,5 +1,7 @@
 #include "unittestframework.h"
 
+#include <deque>
+
 #include <cpputils/datapacking.h>
 #include <cpputils/datapacking.h>
 TEST_CASE("packer") {
@@ -166,3 +168,206 @@ TEST_CASE("packer") {
     }
 }
 
+TEST_CASE("varint") {
+    SECTION("zigzag") {
+        CHECK(zigzag_encode(0) == 0);
+        CHECK(zigzag_encode(-1) == 1);
+        CHECK(zigzag_encode(1) == 2);
+        CHECK(zigzag_encode(-2) == 3);
+        CHECK(zigzag_encode(INT64_MAX) == UINT64_MAX-1);
+        CHECK(zigzag_encode(INT64_MIN) == UINT64_MAX);
+        for (int64_t v : { int64_t(0), int64_t(-1), int64_t(12345), int64_t(-12345), INT64_MAX, INT64_MIN })
+            CHECK(zigzag_decode(zigzag_encode(v)) == v);
+    }
+    SECTION("encoding") {
+        std::vector<uint8_t> data;
+        packer p(std::back_inserter(data), std::back_inserter(data));
+        p.setvarint(300);
+        p.setvarint(0);
+        p.setsvarint(-65);
+        CHECK(data == std::vector<uint8_t>{ 0xac, 0x02, 0x00, 0x81, 0x01 });
+
+        std::vector<uint8_t> small(1);
+        auto q = makepacker(small);
+        CHECK_THROWS(q.setvarint(300));
+        CHECK_NOTHROW(q.setvarint(127));
+    }
+    SECTION("roundtrip") {
+        std::vector<uint64_t> values;
+        for (int bits = 0 ; bits <= 64 ; bits++) {
+            uint64_t v = bits==64 ? ~uint64_t(0) : (uint64_t(1)<<bits)-1;
+            values.push_back(v);
+            values.push_back(v+1);
+            values.push_back(v/3);
+        }
+
+        std::vector<uint8_t> data;
+        packer p(std::back_inserter(data), std::back_inserter(data));
+        size_t total = 0;
+        for (auto v : values) {
+            p.setvarint(v);
+            total += varint_size(v);
+        }
+        CHECK(data.size() == total);
+
+        // vector iterators take the single-load path
+        auto u = makeunpacker(data);
+        for (auto v : values)
+            CHECK(u.getvarint() == v);
+        CHECK(u.eof());
+
+        // deque iterators are not contiguous, and take the bytewise path
+        std::deque<uint8_t> dq(data.begin(), data.end());
+        auto w = makeunpacker(dq.begin(), dq.end());
+        for (auto v : values)
+            CHECK(w.getvarint() == v);
+        CHECK(w.eof());
+
+        // unchecked
+        auto x = unchecked_unpacker(data.begin(), data.end());
+        for (auto v : values)
+            CHECK(x.getvarint() == v);
+        CHECK(unchecked::getvarint(data.begin()) == values[0]);
+
+        // bulk
+        std::vector<uint64_t> decoded;
+        auto y = makeunpacker(data);
+        y.getvarints(std::back_inserter(decoded), values.size());
+        CHECK(decoded == values);
+    }
+    SECTION("bulk") {
+        std::vector<int64_t> values;
+        for (int i = -200 ; i < 200 ; i++)
+            values.push_back(i%7 ? i/4 : i*1000);
+
+        std::vector<uint8_t> data;
+        packer p(std::back_inserter(data), std::back_inserter(data));
+        for (auto v : values)
+            p.setsvarint(v);
+
+        std::vector<uint64_t> decoded(values.size());
+        auto u = makeunpacker(data);
+        u.getvarints(decoded.begin(), decoded.size());
+        CHECK(u.eof());
+        for (size_t i = 0 ; i < values.size() ; i++)
+            CHECK(zigzag_decode(decoded[i]) == values[i]);
+    }
+    SECTION("errors") {
+        // truncated
+        std::vector<uint8_t> data{ 0x80, 0x80 };
+        auto u = makeunpacker(data);
+        CHECK_THROWS(u.getvarint());
+
+        // truncated, with more than 8 bytes available
+        std::vector<uint8_t> data2(9, 0x80);
+        auto v = makeunpacker(data2);
+        CHECK_THROWS(v.getvarint());
+
+        // too long
+        std::vector<uint8_t> data3(11, 0x80);
+        data3.push_back(0);
+        auto w = makeunpacker(data3);
+        CHECK_THROWS(w.getvarint());
+
+        std::vector<uint64_t> out(3);
+        std::vector<uint8_t> data4{ 1, 2 };
+        auto x = makeunpacker(data4);
+        CHECK_THROWS(x.getvarints(out.begin(), 3));
+    }
+}
+TEST_CASE("bitpacker") {
+    std::vector<uint8_t> data;
+    bitpacker p(std::back_inserter(data), std::back_inserter(data));
+    p.setbits(3, 5);
+    p.setbit(true);
+    p.setbits(12, 0xABC);
+    p.setbits(64, 0x0123456789abcdefULL);
+    p.setbits(5, 0x1f);
+    p.align();
+    CHECK(data.size() == 11);
+    CHECK(data[0] == 0xBA);
+    CHECK(data[1] == 0xBC);
+    CHECK(data[10] == 0xF8);
+
+    bitunpacker u(data.begin(), data.end());
+    CHECK(u.getbits(3) == 5);
+    CHECK(u.getbit());
+    CHECK(u.getbits(12) == 0xABC);
+    CHECK(u.getbits(64) == 0x0123456789abcdefULL);
+    CHECK(u.getbits(2) == 3);
+    u.align();
+    CHECK(u.eof());
+    CHECK_THROWS(u.getbits(1));
+
+    // byte aligned reading continues after align
+    std::vector<uint8_t> bytes{ 0xF0, 0x12 };
+    bitunpacker v(bytes.begin(), bytes.end());
+    CHECK(v.getbits(4) == 0xF);
+    v.align();
+    CHECK(*v.p == 0x12);
+}
+TEST_CASE("vectorpacker") {
+    SECTION("compare") {
+        std::vector<uint8_t> expected;
+        packer p(std::back_inserter(expected), std::back_inserter(expected));
+        std::vector<uint8_t> data;
+        vectorpacker q(data);
+        for (int i = 0 ; i < 1000 ; i++) {
+            p.set8(i);                  q.set8(i);
+            p.set16le(i*3);             q.set16le(i*3);
+            p.set24be(i*5);             q.set24be(i*5);
+            p.set32be(i*0x010203u);      q.set32be(i*0x010203u);
+            p.set64le(i*0x1234567890ULL); q.set64le(i*0x1234567890ULL);
+            p.setvarint(i*i*i);         q.setvarint(i*i*i);
+            p.setzstr("abc");           q.setzstr("abc");
+        }
+        CHECK(q.size() == expected.size());
+        CHECK(std::equal(q.span().begin(), q.span().end(), expected.begin(), expected.end()));
+        q.finish();
+        CHECK(data == expected);
+    }
+    SECTION("append") {
+        std::vector<uint8_t> data{ 1, 2, 3 };
+        {
+            vectorpacker p(data, 1000);
+            CHECK(data.size() >= 1003);
+            p.set16be(0x0405);
+            CHECK(p.position() == 5);
+            CHECK(p.size() == 2);
+            CHECK(p.span().size() == 2);
+            CHECK(p.span()[0] == 4);
+        }
+        // destructor truncates the reserved space
+        CHECK(data == std::vector<uint8_t>{ 1, 2, 3, 4, 5 });
+    }
+    SECTION("singlestore") {
+        std::vector<uint8_t> data(16);
+        unchecked_packer p(&data[0], &data[0]+data.size());
+        p.set64be(0x0102030405060708ULL);
+        p.set32le(0x0c0b0a09);
+        p.set16be(0x0d0e);
+        p.set16le(0x100f);
+        for (int i = 0 ; i < 16 ; i++)
+            CHECK(data[i] == i+1);
+    }
+}
+TEST_CASE("segmentpacker") {
+    std::vector<uint8_t> payload1{ 'x', 'y' };
+    std::vector<uint8_t> payload2{ 'z' };
+
+    std::vector<uint8_t> hdr;
+    segmentpacker p(hdr);
+    p.addpayload(payload1);
+    p.set16be(0x4142);
+    p.addpayload(payload2);
+    p.addpayload(payload1);
+    p.set8('C');
+
+    CHECK(p.totalsize() == 8);
+
+    std::string all;
+    for (auto seg : p.segments())
+        all += std::string(seg.begin(), seg.end());
+    CHECK(all == "xyABzxyC");
+    CHECK(p.segments().size() == 5);
+}
@@ -0,0 +1,146 @@
+#include "unittestframework.h"
+
+#include <cpputils/datarecord.h>
+#include <cpputils/datarecord.h>
+
+namespace {
+struct item {
+    uint16_t id;
+    int32_t value;
+};
+using item_layout = record::layout<item,
+    record::field<&item::id, record::le<2>>,
+    record::field<&item::value, record::be<4>>
+>;
+
+struct header {
+    uint32_t magic;
+    uint8_t version;
+    std::string name;
+    std::string comment;
+    std::string label;
+    std::vector<uint32_t> offsets;
+    std::array<uint16_t, 3> triple;
+    std::vector<item> items;
+};
+using header_layout = record::layout<header,
+    record::field<&header::magic, record::be<4>>,
+    record::field<&header::version, record::le<1>>,
+    record::pad<3>,
+    record::field<&header::name, record::fixedstr<8>>,
+    record::field<&header::comment, record::zstr>,
+    record::field<&header::label, record::lenstr<record::le<1>>>,
+    record::field<&header::offsets, record::counted<record::le<2>, record::le<4>>>,
+    record::field<&header::triple, record::fixedarray<3, record::be<2>>>,
+    record::field<&header::items, record::counted<record::le<1>, item_layout>>
+>;
+}
+
+TEST_CASE("datarecord") {
+    SECTION("fixedsize") {
+        static_assert(item_layout::fixedsize == 6);
+        static_assert(item_layout::offsets[1] == 2);
+        static_assert(header_layout::fixedsize == record::variable);
+        static_assert(header_layout::offsets[3] == 8);
+
+        CHECK(item_layout::encodedsize(item{}) == 6);
+    }
+    SECTION("item") {
+        std::vector<uint8_t> data(6);
+        auto p = makepacker(data);
+        item_layout::put(p, item{0x1234, -2});
+        CHECK(p.eof());
+        CHECK(data == std::vector<uint8_t>{ 0x34, 0x12, 0xff, 0xff, 0xff, 0xfe });
+
+        auto u = makeunpacker(data);
+        auto x = item_layout::get(u);
+        CHECK(x.id == 0x1234);
+        CHECK(x.value == -2);
+
+        auto v = makeunpacker(data.begin(), data.begin()+5);
+        CHECK_THROWS(item_layout::get(v));
+    }
+    SECTION("header") {
+        header h{ 0x41424344, 7, "name", "comment", "lbl", { 1, 2, 3 }, { 4, 5, 6 }, { { 1, 2 }, { 3, 4 } } };
+
+        size_t size = header_layout::encodedsize(h);
+        CHECK(size == 4+1+3+8+8+4+2+12+6+1+12);
+
+        std::vector<uint8_t> data(size);
+        auto p = makepacker(data);
+        header_layout::put(p, h);
+        CHECK(p.eof());
+
+        auto u = makeunpacker(data);
+        auto x = header_layout::get(u);
+        CHECK(u.eof());
+        CHECK(x.magic == h.magic);
+        CHECK(x.version == h.version);
+        CHECK(x.name == h.name);
+        CHECK(x.comment == h.comment);
+        CHECK(x.label == h.label);
+        CHECK(x.offsets == h.offsets);
+        CHECK(x.triple == h.triple);
+        REQUIRE(x.items.size() == 2);
+        CHECK(x.items[1].id == 3);
+        CHECK(x.items[1].value == 4);
+
+        // a count larger than the available data
+        data[data.size()-13] = 3;
+        auto v = makeunpacker(data);
+        CHECK_THROWS(header_layout::get(v));
+    }
+    SECTION("backinsert") {
+        header h{ 1, 2, "toolongname", "", "", {}, {}, {} };
+        std::vector<uint8_t> data;
+        packer p(std::back_inserter(data), std::back_inserter(data));
+        CHECK_THROWS(header_layout::put(p, h));
+
+        h.name = "12345678";
+        data.clear();
+        packer q(std::back_inserter(data), std::back_inserter(data));
+        header_layout::put(q, h);
+        CHECK(data.size() == header_layout::encodedsize(h));
+    }
+    SECTION("columns") {
+        std::vector<item> items;
+        for (int i = 0 ; i < 100 ; i++)
+            items.push_back(item{uint16_t(i), -i});
+
+        std::vector<uint8_t> data(items.size()*item_layout::fixedsize + 1);
+        auto p = makepacker(data);
+        for (auto& i : items)
+            item_layout::put(p, i);
+
+        auto u = makeunpacker(data);
+        auto [ids, values] = item_layout::getcolumns(u, items.size());
+        CHECK(u.p == data.end()-1);
+        REQUIRE(ids.size() == 100);
+        REQUIRE(values.size() == 100);
+        for (int i = 0 ; i < 100 ; i++) {
+            CHECK(ids[i] == i);
+            CHECK(values[i] == -i);
+        }
+
+        auto v = makeunpacker(data);
+        CHECK_THROWS(item_layout::getcolumns(v, items.size()+1));
+
+        // counts for which count*fixedsize does not fit in an int
+        CHECK_THROWS(item_layout::getcolumns(v, size_t(1)<<63));
+        CHECK_THROWS(item_layout::getarray(v, (size_t(1)<<32) + 1));
+
+        auto w = makeunpacker(data);
+        auto arr = item_layout::getarray(w, 3);
+        REQUIRE(arr.size() == 3);
+        CHECK(arr[2].id == 2);
+        CHECK(arr[2].value == -2);
+    }
+    SECTION("lenstr-overflow") {
+        std::vector<uint8_t> data(16, 0xff);
+        auto u = makeunpacker(data);
+        std::string str;
+        CHECK_THROWS(record::lenstr<record::le<8>>::get(u, str));
+        auto v = makeunpacker(data);
+        CHECK_THROWS(record::lenstr<record::le<4>>::get(v, str));
+    }
+}
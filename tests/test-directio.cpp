@@ -0,0 +1,100 @@
+#include "unittestframework.h"
+
+#include <cpputils/directio.h>
+#include <cpputils/directio.h>
+
+#include <stdlib.h>
+#include <vector>
+
+TEST_CASE("alignedpool") {
+    alignedpool pool(8192, 4096, 2);
+    {
+        auto a = pool.get();
+        auto b = pool.get();
+        auto c = pool.get();
+        CHECK( a.size() == 8192 );
+        CHECK( (uintptr_t(a.data()) % 4096) == 0 );
+        CHECK( (uintptr_t(c.data()) % 4096) == 0 );
+        CHECK( pool.available() == 0 );
+    }
+    // at most 2 buffers are kept.
+    CHECK( pool.available() == 2 );
+    auto d = pool.get();
+    CHECK( pool.available() == 1 );
+
+    CHECK_THROWS( alignedpool(4096, 3) );
+}
+
+TEST_CASE("directfile") {
+    // O_DIRECT is not supported on all filesystems, tmpfs for instance.
+    char name[] = "/var/tmp/directio-XXXXXX";
+    int fd = mkstemp(name);
+    REQUIRE( fd != -1 );
+    ::close(fd);
+    std::unique_ptr<directfile> pf;
+    try {
+        pf = std::make_unique<directfile>(name, O_RDWR);
+    }
+    catch (const std::system_error&) {
+    }
+    ::unlink(name);
+    if (!pf)
+        return;
+    auto& f = *pf;
+
+    size_t bs = f.blocksize();
+    CHECK( bs >= 512 );
+    CHECK( (bs & (bs-1)) == 0 );
+    CHECK( f.memalign() <= bs );
+
+    std::vector<uint8_t> data(10*bs + 123);
+    for (size_t i = 0 ; i < data.size() ; i++)
+        data[i] = i*7 + i/251;
+
+    SECTION("unaligned") {
+        CHECK( f.pwrite(5, data.data(), data.size()) == data.size() );
+        CHECK( f.size() == data.size()+5 );
+
+        std::vector<uint8_t> rd(data.size() + 100);
+        CHECK( f.pread(5, rd.data(), rd.size()) == data.size() );
+        CHECK( std::equal(data.begin(), data.end(), rd.begin()) );
+
+        // the head was zero filled
+        uint8_t head[8];
+        CHECK( f.pread(0, head, 8) == 8 );
+        CHECK( head[0] == 0 );
+        CHECK( head[4] == 0 );
+        CHECK( head[5] == data[0] );
+
+        // overwrite part of a block
+        uint8_t patch[3] = { 1, 2, 3 };
+        CHECK( f.pwrite(bs-1, patch, 3) == 3 );
+        CHECK( f.size() == data.size()+5 );
+        uint8_t check[5];
+        CHECK( f.pread(bs-2, check, 5) == 5 );
+        CHECK( check[0] == data[bs-7] );
+        CHECK( check[1] == 1 );
+        CHECK( check[3] == 3 );
+        CHECK( check[4] == data[bs+2-5] );
+
+        // reading past the end
+        CHECK( f.pread(data.size()+5, rd.data(), 10) == 0 );
+    }
+    SECTION("aligned") {
+        auto buf = f.pool().get();
+        REQUIRE( buf.size() >= 2*bs );
+        std::copy(data.begin(), data.begin() + 2*bs, buf.data());
+        CHECK( f.isaligned(bs, buf.data(), 2*bs) );
+        CHECK( f.pwrite(bs, buf.data(), 2*bs) == 2*bs );
+        CHECK( f.size() == 3*bs );
+
+        std::fill(buf.begin(), buf.end(), 0);
+        CHECK( f.pread(bs, buf.data(), buf.size()) == 2*bs );
+        CHECK( std::equal(data.begin(), data.begin() + 2*bs, buf.data()) );
+
+        // aligned buffer, unaligned size
+        CHECK( f.pread(0, buf.data(), bs+10) == bs+10 );
+        CHECK( buf[0] == 0 );
+        CHECK( buf[bs+9] == data[9] );
+    }
+}
@@ -5,6 +5,8 @@
 #include <cpputils/fhandle.h>
 #include <cpputils/fhandle.h>
 #include <vector>
+#include <string>
+#include <thread>
 
 // TODO: this test just crashes directly on windows.
 TEST_CASE("filehandle") {
@@ -206,6 +208,146 @@ TEST_CASE("filehandle") {
         // reading returns EOF
         CHECK_THROWS( g.write("abc", 3) );  // writing fails, because f is closed.
     }
+    SECTION("vectored") {
+        int fpair[2];
+        ::pipe(fpair);
+
+        filehandle f = fpair[0];
+        filehandle g = fpair[1];
+
+        std::vector<uint8_t> hdr{ 'a', 'b' };
+        std::string payload = "cdef";
+        std::vector<std::span<const uint8_t>> segs{ hdr, std::span((const uint8_t*)payload.data(), payload.size()), hdr };
+        CHECK( g.writev(segs) == 8 );
+        CHECK( g.writev({ hdr, hdr }) == 4 );
+
+        std::vector<uint8_t> a(3), b(20);
+        CHECK( f.readv({ a, b }) == 12 );
+        CHECK( a == std::vector<uint8_t>{ 'a', 'b', 'c' } );
+        CHECK( std::string(b.begin(), b.begin()+9) == "defababab" );
+
+        // more ranges than fit in the fixed iovec array
+        std::vector<std::string> many(100, "x");
+        CHECK( g.writev(many) == 100 );
+        CHECK( f.read(200).size() == 100 );
+
+        // like the syscall, more than IOV_MAX ranges fail
+        std::vector<std::string> toomany(filehandle::iovecs::maxcount + 1, "x");
+        CHECK_THROWS( g.writev(toomany) );
+
+        // writevall writes everything, also when the pipe is full, and with more than IOV_MAX ranges.
+        std::vector<std::string> chunks;
+        for (int i = 0 ; i < 3000 ; i++)
+            chunks.push_back(std::string(i % 200, 'a' + i % 26));
+        std::string expected;
+        for (auto& c : chunks)
+            expected += c;
+        std::string received;
+        std::thread reader([&]() {
+            while (received.size() < expected.size()) {
+                auto data = f.read(0x10000);
+                received.append(data.begin(), data.end());
+            }
+        });
+        CHECK( g.writevall(chunks) == expected.size() );
+        reader.join();
+        CHECK( received == expected );
+    }
+    SECTION("pvectored") {
+        char name[] = "/tmp/fhandle-XXXXXX";
+        filehandle f = mkstemp(name);
+        ::unlink(name);
+
+        std::vector<uint8_t> a{ 1, 2, 3 }, b{ 4, 5 };
+        CHECK( f.pwritev(10, { a, b }) == 5 );
+        CHECK( f.size() == 15 );
+        CHECK( f.tell() == 0 );
+
+        std::vector<uint8_t> x(2), y(4);
+        CHECK( f.preadv(9, { x, y }) == 6 );
+        CHECK( x == std::vector<uint8_t>{ 0, 1 } );
+        CHECK( y == std::vector<uint8_t>{ 2, 3, 4, 5 } );
+
+        std::vector<std::string> chunks;
+        std::string expected;
+        for (int i = 0 ; i < 2500 ; i++) {
+            chunks.push_back(std::to_string(i));
+            expected += chunks.back();
+        }
+        CHECK( f.pwritevall(100, chunks) == expected.size() );
+        std::vector<uint8_t> back(expected.size());
+        CHECK( f.pread(100, back.data(), back.size()) == back.size() );
+        CHECK( std::string(back.begin(), back.end()) == expected );
+        CHECK( f.tell() == 0 );
+
+        f.datasync();
+        f.fsync();
+    }
+    SECTION("transfer") {
+        char name[] = "/tmp/fhandle-XXXXXX";
+        filehandle src = mkstemp(name);
+        ::unlink(name);
+        char name2[] = "/tmp/fhandle-XXXXXX";
+        filehandle dst = mkstemp(name2);
+        ::unlink(name2);
+
+        std::vector<uint8_t> data(1000000);
+        for (size_t i = 0 ; i < data.size() ; i++)
+            data[i] = i*13;
+        src.pwrite(0, data.data(), data.size());
+
+        // copy with offsets
+        CHECK( src.pcopyto(10, dst, 100, 1000) == 1000 );
+        CHECK( dst.size() == 1100 );
+        CHECK( src.tell() == 0 );
+        CHECK( dst.tell() == 0 );
+        std::vector<uint8_t> buf(1000);
+        dst.pread(100, buf.data(), buf.size());
+        CHECK( std::equal(buf.begin(), buf.end(), data.begin()+10) );
+
+        // stops at EOF
+        CHECK( src.pcopyto(data.size()-5, dst, 0, 100) == 5 );
+
+        // copy using the filepointers
+        dst.trunc(0);
+        src.seek(1);
+        CHECK( src.copyto(dst, 2000000) == data.size()-1 );
+        CHECK( src.tell() == data.size() );
+        CHECK( dst.tell() == data.size()-1 );
+        std::vector<uint8_t> all(data.size()-1);
+        dst.pread(0, all.data(), all.size());
+        CHECK( std::equal(all.begin(), all.end(), data.begin()+1) );
+
+        // to a pipe
+        int fpair[2];
+        REQUIRE( ::pipe(fpair) == 0 );
+        filehandle rd = fpair[0];
+        filehandle wr = fpair[1];
+        src.seek(0);
+        CHECK( src.copyto(wr, 100) == 100 );
+        CHECK( rd.read(200) == std::vector<uint8_t>(data.begin(), data.begin()+100) );
+
+        // from a pipe
+        wr.write(data.data(), 50);
+        wr.close();
+        dst.seek(0);
+        CHECK( rd.copyto(dst, 1000) == 50 );
+        dst.pread(0, buf.data(), 50);
+        CHECK( std::equal(buf.begin(), buf.begin()+50, data.begin()) );
+
+#ifdef __linux__
+        CHECK( src.copyrange(0, dst, 0, 10) == 10 );
+        CHECK( src.sendfile(0, dst, 10) == 10 );
+
+        int ppair[2];
+        REQUIRE( ::pipe(ppair) == 0 );
+        filehandle prd = ppair[0];
+        filehandle pwr = ppair[1];
+        src.seek(20);
+        CHECK( src.splice(pwr, 10) == 10 );
+        CHECK( prd.read(20) == std::vector<uint8_t>(data.begin()+20, data.begin()+30) );
+#endif
+    }
 #endif
     // TODO
     //  - read(first,last)
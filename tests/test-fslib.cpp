@@ -2,13 +2,313 @@
 #include <cpputils/fslibrary.h>
 #include <cpputils/fslibrary.h>
 #include <cpputils/formatter.h>
+#ifndef _WIN32
+#include <cpputils/fhandle.h>
+#include <cpputils/fsindex.h>
+#endif
+
+#ifndef _WIN32
+#include <set>
+#include <filesystem>
+#include <mutex>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+// creates a temporary tree with `ndirs` directories of `nfiles` files, nested `depth` levels deep.
+// returns the list of all created paths
+static std::set<std::string> maketree(const std::string& root, int ndirs, int nfiles, int depth)
+{
+    std::set<std::string> paths;
+    for (int f = 0 ; f < nfiles ; f++) {
+        auto fn = root + "/file" + std::to_string(f);
+        ::close(::open(fn.c_str(), O_CREAT|O_WRONLY, 0666));
+        paths.insert(fn);
+    }
+    if (depth == 0)
+        return paths;
+    for (int d = 0 ; d < ndirs ; d++) {
+        auto dn = root + "/dir" + std::to_string(d);
+        ::mkdir(dn.c_str(), 0777);
+        paths.insert(dn);
+        auto sub = maketree(dn, ndirs, nfiles, depth-1);
+        paths.insert(sub.begin(), sub.end());
+    }
+    return paths;
+}
+struct tmptree {
+    std::string root;
+    std::set<std::string> paths;
+    tmptree(int ndirs, int nfiles, int depth)
+    {
+        char name[] = "/tmp/fslib-XXXXXX";
+        root = mkdtemp(name);
+        paths = maketree(root, ndirs, nfiles, depth);
+    }
+    ~tmptree() { std::filesystem::remove_all(root); }
+};
+#endif
 
 TEST_CASE("fileenum") {
     int n = 0;
     for (auto [p, e] : fileenumerator("."))
     {
         //print("p:%s\n\te:%s\n", p, e);
+        CHECK(!p.empty());
         n++;
     }
     CHECK(n>0);
 }
+
+#ifndef _WIN32
+TEST_CASE("fileenum-paths") {
+    tmptree tree(3, 4, 3);
+
+    std::set<std::string> found;
+    for (auto [p, e] : fileenumerator(tree.root))
+        found.insert(std::string(p));
+
+    // directories themselves are not reported, only their contents.
+    std::set<std::string> files;
+    for (auto& p : tree.paths)
+        if (p.find("/file") != p.npos)
+            files.insert(p);
+    CHECK( found == files );
+
+    std::set<std::string> missing;
+    for (auto [p, e] : fileenumerator(tree.root + "/missing"))
+        missing.insert(std::string(p));
+    CHECK( missing.empty() );
+}
+
+TEST_CASE("fileenum-filter") {
+    tmptree tree(3, 4, 3);
+    auto count = [](const fileenumerator& e) {
+        std::set<std::string> found;
+        for (auto [p, ent] : e)
+            found.insert(std::string(p));
+        return found;
+    };
+
+    CHECK( count(fileenumerator(tree.root, fileenumerator::FILT_ALL)) == tree.paths );
+    CHECK( count(fileenumerator(tree.root, fileenumerator::FILT_DIRECTORY)).size() == 3 + 9 + 27 );
+    CHECK( count(fileenumerator(tree.root, fileenumerator::FILT_SYMLINK)).empty() );
+
+    // name predicates select which entries are yielded, all directories are still entered.
+    CHECK( count(fileenumerator(tree.root).glob("file[12]")).size() == 2 * (1 + 3 + 9 + 27) );
+    CHECK( count(fileenumerator(tree.root, fileenumerator::FILT_ALL).regex("dir[0-9]")).size() == 3 + 9 + 27 );
+    CHECK( count(fileenumerator(tree.root).match([](const char *name) { return name[4] == '3'; })).size() == 1 + 3 + 9 + 27 );
+
+    // pruned directories are yielded, but not entered.
+    auto pruned = count(fileenumerator(tree.root, fileenumerator::FILT_ALL).skipdirs([](std::string_view path, auto& ent) { return ent.name() != "dir0"; }));
+    CHECK( pruned.size() == 4 + 3 + (4 + 3 + (4 + 3 + 4)) );
+    CHECK( pruned.count(tree.root + "/dir1") == 1 );
+    CHECK( pruned.count(tree.root + "/dir1/file0") == 0 );
+    CHECK( pruned.count(tree.root + "/dir0/dir0/dir0/file0") == 1 );
+}
+
+TEST_CASE("fileenum-stat") {
+    tmptree tree(2, 5, 2);
+    {
+        filehandle f(::open((tree.root + "/dir1/file2").c_str(), O_WRONLY));
+        f.write("hello", 5);
+    }
+    int nfiles = 0, ndirs = 0;
+    uint64_t total = 0;
+    for (auto [p, ent] : fileenumerator(tree.root, fileenumerator::FILT_ALL).withstat(fileenumerator::STAT_SIZE|fileenumerator::STAT_MODE)) {
+        REQUIRE( ent.st != nullptr );
+        CHECK( (ent.st->fields & fileenumerator::STAT_SIZE) );
+        if (S_ISDIR(ent.st->mode)) {
+            CHECK( ent.isdir() );
+            ndirs++;
+        }
+        else {
+            CHECK( S_ISREG(ent.st->mode) );
+            total += ent.st->size;
+            nfiles++;
+        }
+    }
+    CHECK( nfiles == 5 * 7 );
+    CHECK( ndirs == 6 );
+    CHECK( total == 5 );
+
+    // without withstat, no stat info is provided.
+    for (auto [p, ent] : fileenumerator(tree.root))
+        CHECK( ent.st == nullptr );
+}
+
+template<typename STREAM>
+std::set<std::string> readnames(STREAM& d, const std::string& dir)
+{
+    std::set<std::string> names;
+    if (!d.open(dir.c_str()))
+        return names;
+    while (auto ent = d.next())
+        names.insert(dir + "/" + ent->d_name);
+    d.close();
+    return names;
+}
+TEST_CASE("dirstream") {
+    tmptree tree(0, 3000, 0);
+
+    fileenumerator::readdirstream rd;
+    auto names = readnames(rd, tree.root);
+    CHECK( names.size() == tree.paths.size() + 2 );
+    CHECK( names.count(tree.root + "/..") == 1 );
+#ifdef FSLIB_HAVE_GETDENTS
+    // a small buffer, so many getdents64 calls are needed.
+    fileenumerator::getdentsstream gd(4096);
+    CHECK( readnames(gd, tree.root) == names );
+    CHECK( readnames(gd, tree.root + "/missing").empty() );
+#endif
+}
+
+TEST_CASE("parallelwalk") {
+    tmptree tree(3, 4, 3);
+
+    for (unsigned nthreads : { 1, 2, 8 }) {
+        std::mutex mtx;
+        std::set<std::string> found;
+        int ndirs = 0;
+        parallelwalk(tree.root, [&](const std::string& path, const fileenumerator::fileent& ent) {
+            std::unique_lock<std::mutex> lock(mtx);
+            found.insert(path);
+            if (ent.isdir())
+                ndirs++;
+        }, nthreads);
+        CHECK( found == tree.paths );
+        CHECK( ndirs == 3 + 9 + 27 );
+    }
+
+    // exceptions stop the walk
+    CHECK_THROWS( parallelwalk(tree.root, [](auto&, auto&) { throw std::runtime_error("stop"); }, 4) );
+
+    // a missing root yields nothing
+    int n = 0;
+    parallelwalk(tree.root + "/missing", [&n](auto&, auto&) { n++; });
+    CHECK( n == 0 );
+
+    // a walker reused after an aborted walk does not continue the old walk.
+    tmptree other(0, 5, 0);
+    bool fail = true;
+    std::mutex mtx;
+    std::set<std::string> found;
+    parallelwalker w([&](const std::string& path, auto&) {
+        // stop deep in the tree, when other directories are still queued.
+        if (fail) {
+            if (path.ends_with("dir1/dir1/file3"))
+                throw std::runtime_error("stop");
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        found.insert(path);
+    }, 4);
+    CHECK_THROWS( w.walk(tree.root) );
+    fail = false;
+    w.walk(other.root);
+    CHECK( found == other.paths );
+}
+#endif
+
+#ifndef _WIN32
+// move the mtime of all directories in the tree into the past, so fsindex does not consider them racy.
+static void backdate(const tmptree& tree)
+{
+    struct timespec times[2] = { { time(nullptr) - 3600, 0 }, { time(nullptr) - 3600, 0 } };
+    ::utimensat(AT_FDCWD, tree.root.c_str(), times, 0);
+    for (auto& p : tree.paths)
+        if (p.find("/file") == p.npos)
+            ::utimensat(AT_FDCWD, p.c_str(), times, 0);
+}
+
+TEST_CASE("fsindex") {
+    tmptree tree(3, 4, 2);
+    backdate(tree);
+    auto idxname = tree.root + ".idx";
+    struct cleanup { std::string name; ~cleanup() { ::unlink(name.c_str()); } } cleanup{idxname};
+
+    {
+        fsindex idx(idxname);
+        CHECK( idx.empty() );
+        CHECK_THROWS( idx.refresh() );
+        idx.build(tree.root + "/");
+        CHECK( idx.root() == tree.root );
+        CHECK( idx.dircount() == 1 + 3 + 9 );
+        CHECK( idx.entrycount() == tree.paths.size() );
+
+        std::set<std::string> found;
+        idx.foreach([&](std::string_view dir, const fsindex::entry& e) {
+            found.insert(std::string(dir) + "/" + std::string(e.name));
+        });
+        CHECK( found == tree.paths );
+    }
+
+    // reload from disk, nothing changed
+    fsindex idx(idxname);
+    CHECK( idx.entrycount() == tree.paths.size() );
+    CHECK( idx.refresh() == 0 );
+
+    auto e = idx.find(tree.root + "/dir1/dir2");
+    REQUIRE( e );
+    CHECK( e->isdir() );
+    CHECK( idx.find(tree.root + "/dir1/file9") == std::nullopt );
+    CHECK( idx.find(tree.root + "/missing/file0") == std::nullopt );
+
+    // a new file is found by reading only its directory.
+    {
+        filehandle f(tree.root + "/dir1/dir2/newfile", O_RDWR|O_CREAT);
+        f.write("abc", 3);
+    }
+    CHECK( idx.refresh() == 1 );
+    e = idx.find(tree.root + "/dir1/dir2/newfile");
+    REQUIRE( e );
+    CHECK( e->size == 3 );
+
+    // removing a directory removes its subtree.
+    std::filesystem::remove_all(tree.root + "/dir2");
+    idx.refresh();
+    CHECK( idx.dircount() == 1 + 2 + 6 );
+    CHECK( idx.find(tree.root + "/dir2/file0") == std::nullopt );
+
+    // a missing root, or a root which is not a directory, is an error, not an empty tree.
+    {
+        fsindex bad(idxname + ".bad");
+        CHECK_THROWS_AS( bad.build(tree.root + "/missing"), std::system_error );
+        CHECK_THROWS_AS( bad.build(tree.root + "/dir1/file0"), std::system_error );
+        CHECK( bad.empty() );
+    }
+    // a symlink to a directory can be used as the root.
+    {
+        auto link = tree.root + ".lnk";
+        REQUIRE( ::symlink(tree.root.c_str(), link.c_str()) == 0 );
+        fsindex lidx(idxname + ".lnk");
+        lidx.build(link);
+        ::unlink(link.c_str());
+        ::unlink((idxname + ".lnk").c_str());
+        CHECK( lidx.dircount() == idx.dircount() );
+        CHECK( lidx.entrycount() == idx.entrycount() );
+    }
+
+#ifdef __linux__
+    // modifying a file in place does not change the directory mtime, inotify reports it.
+    backdate(tree);
+    idx.build(tree.root);
+    fswatcher w;
+    w.watch(idx);
+    CHECK( w.watched() == idx.dircount() );
+    {
+        filehandle f(tree.root + "/dir0/file1", O_RDWR);
+        f.write("hello", 5);
+    }
+    CHECK( idx.refresh() == 0 );
+    CHECK( idx.find(tree.root + "/dir0/file1")->size == 0 );
+
+    auto changed = w.changes();
+    CHECK( changed == std::set<std::string>{ tree.root + "/dir0" } );
+    CHECK( idx.refresh(changed) == 1 );
+    CHECK( idx.find(tree.root + "/dir0/file1")->size == 5 );
+    CHECK( w.changes().empty() );
+#endif
+}
+#endif
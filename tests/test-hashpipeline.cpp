@@ -0,0 +1,94 @@
+#include "unittestframework.h"
+#include <cpputils/hashpipeline.h>
+#include <cpputils/hashpipeline.h>
+
+#include <map>
+#include <string>
+#include <filesystem>
+#include <stdlib.h>
+#include <fcntl.h>
+
+namespace {
+struct tmpdir {
+    std::string root;
+    tmpdir()
+    {
+        char name[] = "/tmp/hashpipe-XXXXXX";
+        root = mkdtemp(name);
+    }
+    ~tmpdir() { std::filesystem::remove_all(root); }
+
+    // creates a file filled with `size` bytes derived from `seed`, returns its contents.
+    std::vector<uint8_t> create(const std::string& name, size_t size, int seed)
+    {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0 ; i < size ; i++)
+            data[i] = uint8_t(i * 7 + seed);
+        std::filesystem::create_directories(std::filesystem::path(root + "/" + name).parent_path());
+        filehandle f(root + "/" + name, O_RDWR|O_CREAT|O_TRUNC);
+        if (size)
+            f.write(data.data(), data.size());
+        return data;
+    }
+};
+}
+
+TEST_CASE("boundedqueue") {
+    boundedqueue<int> q(2);
+    CHECK( q.push(1) );
+    CHECK( q.push(2) );
+    std::thread t([&q]() { q.push(3); q.close(); });
+    CHECK( q.pop() == 1 );
+    CHECK( q.pop() == 2 );
+    CHECK( q.pop() == 3 );
+    CHECK( q.pop() == std::nullopt );
+    t.join();
+    CHECK( q.push(4) == false );
+}
+
+TEST_CASE("hashpipeline") {
+    tmpdir dir;
+    std::map<std::string, std::vector<uint8_t>> files;
+    for (int i = 0 ; i < 20 ; i++) {
+        auto name = "d" + std::to_string(i % 3) + "/f" + std::to_string(i);
+        files[dir.root + "/" + name] = dir.create(name, i * 100000, i);
+    }
+
+    SECTION("all files") {
+        // small chunks and queues, to exercise the backpressure.
+        hashpipeline hp(dir.root, { .algorithms = hashoptions::CRC32|hashoptions::CRC64, .nthreads = 3, .chunksize = 0x1000, .maxqueued = 2 });
+        size_t n = 0;
+        while (auto r = hp.next()) {
+            REQUIRE( files.count(r->path) == 1 );
+            auto& data = files[r->path];
+            CHECK( r->error == 0 );
+            CHECK( r->size == data.size() );
+            CHECK( r->crc32 == crc32(data.data(), data.size()) );
+            CHECK( r->crc64 == crc64(data.data(), data.size()) );
+            n++;
+        }
+        CHECK( n == files.size() );
+        CHECK( hp.files() == files.size() );
+    }
+    SECTION("prefilters") {
+        dir.create("d1/copy5", 500000, 5);
+        dir.create("d2/other5", 500000, 6);
+
+        std::map<uint64_t, int> sizes;
+        hashpipeline hp(dir.root, { .nthreads = 2, .minsize = 1, .samesizeonly = true });
+        while (auto r = hp.next())
+            sizes[r->size]++;
+        // only the three files of 500000 bytes share their size.
+        CHECK( sizes == std::map<uint64_t, int>{ { 500000, 3 } } );
+    }
+    SECTION("missing root") {
+        hashpipeline hp(dir.root + "/missing", { .nthreads = 2 });
+        CHECK_THROWS_AS( hp.next(), std::system_error );
+        CHECK( !hp.next() );
+    }
+    SECTION("abandoned") {
+        // destroying the pipeline before all results were read.
+        hashpipeline hp(dir.root, { .nthreads = 2, .maxqueued = 1 });
+        CHECK( hp.next() );
+    }
+}
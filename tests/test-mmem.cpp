@@ -6,10 +6,19 @@
 #include <cpputils/mmem.h>
 #include <cpputils/mmfile.h>
 #include <cpputils/mmfile.h>
+#ifndef _WIN32
+#include <cpputils/mmprefetch.h>
+#include <cpputils/mmwindow.h>
+#include <cpputils/anonmem.h>
+#include <cpputils/mmlog.h>
+#include <cpputils/datapacking.h>
+#endif
 #include <cpputils/formatter.h>
 
 #include <vector>
 #include <cstdlib>
+#include <thread>
+#include <atomic>
 
 #if defined(__MACH__) || defined(_WIN32)
 // simulate the linux memfd_create function
@@ -146,3 +155,353 @@ TEST_CASE("mmem2") {
     CHECK( std::equal(rnddata.begin(), rnddata.begin()+256, p0) );
 }
 
+#ifndef _WIN32
+TEST_CASE("mmadvise") {
+    filehandle f(memfd_create("test.dat", 0));
+    f.trunc(0x100000);
+    f.pwrite(0x1234, "abc", 3);
+
+    mappedmem m(f, 0x1000, 0x100000);
+
+    CHECK( m.advise(mappedmem::SEQUENTIAL) );
+    CHECK( m.advise(mappedmem::RANDOM, 0x10, 0x2000) );
+    CHECK( m.advise(mappedmem::NORMAL) );
+    // ranges past the end are clipped.
+    m.prefetch(0x1000, 0x1000000);
+    m.populate(0, 0x10000);
+    m.advise(mappedmem::HUGEPAGE);
+    CHECK( m[0x234] == 'a' );
+
+    mappedfile mf(f, PROT_READ);
+    CHECK( mf.advise(mappedmem::WILLNEED, 0, 0x1000) );
+    mf.populate(0, mf.size());
+    mf.readahead(0, mf.size());
+    CHECK( mf.begin()[0x1235] == 'b' );
+}
+
+TEST_CASE("mmprefetch") {
+    filehandle f(memfd_create("test.dat", 0));
+    f.trunc(0x1000000);
+    mappedfile mf(f, PROT_READ);
+    {
+        mmprefetcher pf(mf.begin(), mf.size(), 0x100000, 0x10000);
+
+        // eventually prefetches `ahead` bytes.
+        for (int i = 0 ; i < 1000 && pf.prefetched() < 0x100000 ; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK( pf.prefetched() == 0x100000 );
+
+        pf.update(0x800000);
+        for (int i = 0 ; i < 1000 && pf.prefetched() < 0x900000 ; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK( pf.prefetched() == 0x900000 );
+
+        // does not go past the end
+        pf.update(0xff0000);
+        for (int i = 0 ; i < 1000 && pf.prefetched() < 0x1000000 ; i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK( pf.prefetched() == 0x1000000 );
+    }
+}
+
+TEST_CASE("mmwindow") {
+    filehandle f(memfd_create("test.dat", 0));
+    const uint64_t filesize = 0x100000 + 0x123;
+    std::vector<uint8_t> data(filesize);
+    for (size_t i = 0 ; i < data.size() ; i++)
+        data[i] = i*7 + i/0x10000;
+    f.write(data.data(), data.size());
+
+    windowedmapping wm(f, 0x10000, 3);
+    CHECK( wm.size() == filesize );
+    CHECK( wm.windowsize() == 0x10000 );
+
+    SECTION("span") {
+        // crossing a window boundary
+        auto s = wm.span(0xfff0, 0x10000);
+        REQUIRE( s.size() == 0x10000 );
+        CHECK( std::equal(s.begin(), s.end(), data.begin()+0xfff0) );
+
+        // near the end
+        s = wm.span(filesize-0x10, 0x100);
+        CHECK( s.size() == 0x10 );
+        CHECK( s[0xf] == data.back() );
+        CHECK( wm.span(filesize, 1).empty() );
+
+        CHECK_THROWS( wm.span(0, 0x10001) );
+
+        for (uint64_t ofs = 0 ; ofs < filesize ; ofs += 0x8000)
+            CHECK( wm.span(ofs, 1)[0] == data[ofs] );
+        CHECK( wm.mapped() == 3 );
+    }
+    SECTION("scan") {
+        uint64_t total = 0;
+        bool ok = true;
+        wm.scan(0x100, filesize, [&](std::span<uint8_t> s) {
+            ok = ok && std::equal(s.begin(), s.end(), data.begin()+0x100+total);
+            total += s.size();
+        });
+        CHECK( ok );
+        CHECK( total == filesize-0x100 );
+        CHECK( wm.mapped() <= 3 );
+    }
+    SECTION("iterator") {
+        CHECK( std::equal(wm.begin(), wm.end(), data.begin(), data.end()) );
+        CHECK( wm.end() - wm.begin() == filesize );
+
+        auto it = wm.at(0xfffe);
+        unpacker u(it, wm.end());
+        CHECK( u.get32le() == (uint32_t(data[0x10001])<<24 | uint32_t(data[0x10000])<<16 | data[0xffff]<<8 | data[0xfffe]) );
+
+        // reading past the end
+        auto last = wm.end();
+        CHECK_THROWS( *last );
+        CHECK( *--last == data.back() );
+    }
+}
+
+TEST_CASE("mmview") {
+    filehandle f(memfd_create("test.dat", 0));
+    std::vector<uint8_t> data(0x3000);
+    for (size_t i = 0 ; i < data.size() ; i++)
+        data[i] = i*3;
+    f.write(data.data(), data.size());
+
+    mappedview rec;
+    {
+        mappedfile mf(f, PROT_READ|PROT_WRITE);
+        auto all = mf.view();
+        CHECK( all.size() == 0x3000 );
+        CHECK( all.mapping() == mf.mapping() );
+
+        rec = all.subview(0x1000, 0x10);
+        CHECK( rec.size() == 0x10 );
+        CHECK( rec[0] == data[0x1000] );
+        CHECK( rec.subview(8).size() == 8 );
+        CHECK( rec.subview(0x20).empty() );
+
+        // copies share the mapping
+        mappedfile copy = mf;
+        CHECK( copy.begin() == mf.begin() );
+        copy.begin()[0x1000] = 0xaa;
+        CHECK( rec[0] == 0xaa );
+
+        // growing with views outstanding creates a new mapping, dirty ranges move along.
+        mf.markdirty(0x1000, 1);
+        auto old = mf.mapping();
+        CHECK( !mf.resize(0x4000) );
+        CHECK( mf.size() == 0x4000 );
+        CHECK( mf.mapping() != rec.mapping() );
+        CHECK( rec[1] == data[0x1001] );
+        CHECK( old->dirtysize() == 0 );
+        CHECK( mf.mapping()->dirtysize() == 0x1000 );
+        old.reset();
+
+        // shrinking is not possible while views exist
+        auto tail = mf.view(0x3000, 0x100);
+        CHECK_THROWS( mf.resize(0x1000) );
+        CHECK( mf.size() == 0x4000 );
+        CHECK( mf.file().size() == 0x4000 );
+        CHECK( tail[0] == 0 );
+        tail = mappedview();
+        CHECK( mf.resize(0x2000) );
+        CHECK( mf.file().size() == 0x2000 );
+    }
+    // the view keeps the mapping alive.
+    CHECK( rec.mapping().use_count() == 1 );
+    CHECK( rec[2] == data[0x1002] );
+    std::span<const uint8_t> s = rec;
+    CHECK( s.size() == 0x10 );
+}
+
+TEST_CASE("anonmem") {
+    SECTION("plain") {
+        anonmem m(0x12345);
+        CHECK( m.size() == 0x12345 );
+        CHECK( !m.usinghugetlb() );
+        CHECK( m[0x12344] == 0 );
+        m[0] = 1;
+        m[0x12344] = 2;
+
+        m.resize(0x1000000);
+        CHECK( m.size() == 0x1000000 );
+        CHECK( m[0] == 1 );
+        CHECK( m[0x12344] == 2 );
+        CHECK( m[0xffffff] == 0 );
+
+        CHECK( m.resize(0x1000) );
+        CHECK( m[0] == 1 );
+    }
+    SECTION("options") {
+        anonmem m(0x400000, anonmem::POPULATE | anonmem::HUGETLB);
+        CHECK( m.size() == 0x400000 );
+        std::fill(m.begin(), m.end(), 0x55);
+        m.resize(0x800000);
+        CHECK( m[0x3fffff] == 0x55 );
+        CHECK( m[0x400000] == 0 );
+
+        anonmem t(0x400000, anonmem::HUGEPAGES);
+        t[0x200000] = 1;
+        CHECK( t[0x200000] == 1 );
+    }
+#ifdef __linux__
+    SECTION("numa") {
+        // node 0 always exists, but mbind may be unavailable on kernels without NUMA support.
+        try {
+            anonmem m(0x100000, anonmem::POPULATE, 0);
+            m[0x1000] = 1;
+            CHECK( m[0x1000] == 1 );
+        }
+        catch (const std::system_error& e) {
+            CHECK( e.code().value() == ENOSYS );
+        }
+        anonmem m(0x1000);
+        CHECK_THROWS( m.bindnode(-1) );
+    }
+#endif
+}
+
+TEST_CASE("mmlog") {
+    filehandle f(memfd_create("test.dat", 0));
+    {
+        mappedlog log(f, 0x10000, 0x1000000, 0x8000);
+        CHECK( log.size() == 0 );
+
+        std::string rec = "record-0123456789";
+        CHECK( log.append(rec) == 0 );
+        auto p0 = log.data();
+
+        // grow over several chunks
+        uint64_t ofs = 0;
+        for (int i = 0 ; i < 10000 ; i++)
+            ofs = log.append(rec.data(), rec.size());
+        CHECK( ofs == 10000*rec.size() );
+        CHECK( log.size() == 10001*rec.size() );
+        CHECK( log.capacity() >= log.size() );
+        CHECK( (log.capacity() + mappedlog::hdrsize) % 0x10000 == 0 );
+        CHECK( log.data() == p0 );
+        CHECK( std::string((char*)log.data() + ofs, rec.size()) == rec );
+
+        auto p = log.allocate(4);
+        std::memcpy(p, "abcd", 4);
+        log.sync();
+        CHECK( f.size() == log.capacity() + mappedlog::hdrsize );
+
+        CHECK( log.span(log.size()-4, 100).size() == 4 );
+
+        // exceeding the reserved range
+        std::vector<uint8_t> big(0x1000000);
+        CHECK_THROWS( log.append(big) );
+    }
+    // truncated to the used size
+    CHECK( f.size() == mappedlog::hdrsize + 10001*17+4 );
+
+    // reopening continues at the end.
+    {
+        mappedlog log(f, 0x10000);
+        CHECK( log.size() == 10001*17+4 );
+        CHECK( std::string((char*)log.end()-4, 4) == "abcd" );
+        log.append("xyz", 3);
+        CHECK( std::string((char*)log.data(), 6) == "record" );
+    }
+
+    // a file which is not a log
+    filehandle g(memfd_create("other.dat", 0));
+    g.write("hello world", 11);
+    CHECK_THROWS( mappedlog(g, 0x10000) );
+}
+
+TEST_CASE("mmlog-crash") {
+    filehandle f(memfd_create("test.dat", 0));
+    // copy of the file, as it would be found after a crash.
+    filehandle crashed(memfd_create("crashed.dat", 0));
+    {
+        mappedlog log(f, 0x10000, 0x1000000, 0x100);
+        log.append("synced", 6);
+        auto p = log.allocate(5);
+        // the background writeback triggered by this append must not count the
+        // incomplete allocated record as synced.
+        log.append(std::string(0x200, 'x'));
+        std::memcpy(p, "alloc", 5);
+        log.sync();
+        log.append("lost", 4);
+
+        std::vector<uint8_t> data(f.size());
+        f.pread(0, data.data(), data.size());
+        crashed.write(data.data(), data.size());
+    }
+    // the preallocated chunk is not truncated, the header points at the end of the last sync.
+    CHECK( crashed.size() == 0x10000 );
+    mappedlog log(crashed, 0x10000);
+    CHECK( log.size() == 6 + 5 + 0x200 );
+    CHECK( std::string((char*)log.data() + 6, 5) == "alloc" );
+    CHECK( log.append("next", 4) == 6 + 5 + 0x200 );
+}
+
+TEST_CASE("mmflush") {
+    filehandle f(memfd_create("test.dat", 0));
+    f.trunc(0x10000);
+    mappedfile mf(f, PROT_READ|PROT_WRITE);
+
+    mf.begin()[0x10] = 1;
+    mf.flush();
+    mf.flush(0x1000, 0x100, false);
+    uint8_t b;
+    f.pread(0x10, &b, 1);
+    CHECK( b == 1 );
+
+    auto& m = *mf.mapping();
+    CHECK( m.dirtysize() == 0 );
+    mf.markdirty(0x10, 1);
+    mf.markdirty(0x1ff0, 0x20);     // two pages
+    CHECK( m.dirtysize() == 0x3000 );
+    mf.markdirty(0x5000, 0x10);
+    CHECK( m.dirtysize() == 0x4000 );
+    mf.markdirty(0xf00, 0x10000);    // clipped, merges everything
+    CHECK( m.dirtysize() == 0x10000 );
+    CHECK( m._dirty.size() == 1 );
+
+    mf.sync();
+    CHECK( m.dirtysize() == 0 );
+}
+
+TEST_CASE("groupcommit") {
+    filehandle f(memfd_create("test.dat", 0));
+    const int nthreads = 8;
+    const int nrecords = 100;
+    f.trunc(nthreads*nrecords*16);
+    mappedfile mf(f, PROT_READ|PROT_WRITE);
+
+    std::atomic<int> inside = 0;
+    bool overlap = false;
+    groupcommit gc([&]() {
+        if (++inside > 1)
+            overlap = true;
+        mf.sync();
+        --inside;
+    });
+
+    std::vector<std::thread> threads;
+    for (int t = 0 ; t < nthreads ; t++)
+        threads.emplace_back([&, t]() {
+            for (int i = 0 ; i < nrecords ; i++) {
+                uint64_t ofs = (t*nrecords + i)*16;
+                std::fill_n(mf.begin() + ofs, 16, uint8_t(t+1));
+                mf.markdirty(ofs, 16);
+                gc.commit();
+            }
+        });
+    for (auto& t : threads)
+        t.join();
+
+    CHECK( !overlap );
+    CHECK( gc.syncs() >= 1 );
+    CHECK( gc.syncs() <= nthreads*nrecords );
+    CHECK( mf.mapping()->dirtysize() == 0 );
+    CHECK( mf.begin()[nthreads*nrecords*16-1] == nthreads );
+
+    // errors are passed to the committing threads.
+    groupcommit failing([]() { throw std::runtime_error("sync failed"); });
+    CHECK_THROWS( failing.commit() );
+}
+#endif
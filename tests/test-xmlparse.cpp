@@ -82,6 +82,23 @@ public:
     }
 
 };
+// uses the compile time interface, only implementing some of the handlers.
+struct SaxXml : XmlSaxParser<SaxXml> {
+    std::vector<std::string> events;
+    std::string_view lastattr;
+
+    void on_starttag(std::string_view tag, const XmlAttributeView& attrs)
+    {
+        std::string ev = "start:" + std::string(tag);
+        for (auto& a : attrs)
+            ev += " " + std::string(a.name) + "=" + a.value();
+        events.push_back(ev);
+        if (!attrs.empty())
+            lastattr = attrs[attrs.size()-1].raw;
+    }
+    void on_endtag(std::string_view tag) { events.push_back("end:" + std::string(tag)); }
+    void on_data(std::string_view text) { events.push_back("data:" + std::string(text)); }
+};
 #ifdef USE_CATCH
 std::ostream& operator<<(std::ostream& os, const std::pair<std::string, std::string>& item)
 {
@@ -139,7 +156,8 @@ TEST_SUITE("xml") {
             INFO("char = " << a << ',' << b);
             if (b=='<')
                 CHECK_THROWS(tst.parse(buf, buf+2));
-            else if (a=='<' && "!?/="s.find(b)==std::string::npos)
+            else if (a=='<')
+                // either invalid, or a tag cut off by the end of the input
                 CHECK_THROWS(tst.parse(buf, buf+2));
             else
                 CHECK_NOTHROW(tst.parse(buf, buf+2));
@@ -163,6 +181,14 @@ TEST_SUITE("xml") {
         CHECK_NOTHROW(tst.parse("<?a?>"s));
         CHECK_NOTHROW(tst.parse("<?a v='123'?>"s));
 
+        // input ending inside a tag
+        CHECK_THROWS(tst.parse("<a x='1'"s));
+        CHECK_THROWS(tst.parse("<a x="s));
+        CHECK_THROWS(tst.parse("<a"s));
+        CHECK_THROWS(tst.parse("<!-- abc"s));
+        CHECK_THROWS(tst.parse("<![CDATA[ abc"s));
+        CHECK_NOTHROW(tst.parse("<a/>"s));
+
         // todo:  <!xxx <!...> >
         // <=>
     }
@@ -195,5 +221,178 @@ TEST_SUITE("xml") {
         CHECK(tst.parsed == tst.mkx(MyXml::ELEM, "a", tst.mkattr("k", "v", "l", "w")));
         tst.parsed.clear();
 
+        tst.parse("<?xml version=\"1.0\" encoding='utf-8'?><a x='1' y='2' z='3'><b/></a>"s);
+        CHECK(tst.parsed == tst.mkx(MyXml::DECL, "xml", tst.mkattr("version", "1.0", "encoding", "utf-8"),
+                                    MyXml::START, "a", tst.mkattr("x", "1", "y", "2", "z", "3"),
+                                    MyXml::ELEM, "b", tst.mkattr(),
+                                    MyXml::END, "a", tst.mkattr()));
+        tst.parsed.clear();
+
+    }
+    TEST_CASE("saxparser") {
+        SaxXml tst;
+        std::string doc = "<a x='1' y=\"two\"><b/>text<!-- ignored --></a>";
+        tst.parse(doc);
+        CHECK(tst.events == std::vector<std::string>{ "start:a x=1 y=two", "start:b", "end:b", "data:text", "end:a" });
+
+        // views refer to the parsed buffer
+        CHECK(tst.lastattr == "two");
+        CHECK(tst.lastattr.data() >= doc.data());
+        CHECK(tst.lastattr.data() < doc.data() + doc.size());
+    }
+    TEST_CASE("attributeview") {
+        std::vector<XmlAttribute> attrs{ { "k", "v" }, { "l", "w" } };
+        XmlAttributeView view(attrs);
+        CHECK(view.size() == 2);
+        CHECK(view.has("l"));
+        CHECK(!view.has("m"));
+        CHECK(view.get("k") == "v");
+        CHECK(view.get("m") == "");
+        CHECK(view.find("l")->raw == "w");
+        CHECK(view.list() == XmlParser::attribute_list{ { "k", "v" }, { "l", "w" } });
+    }
+    TEST_CASE("streaming") {
+        std::string doc = "<?xml version='1.0'?><!DOCTYPE x><root a='1' b=\"2\">text<!-- a > comment --><![CDATA[ <raw> ]]><e k='v'/><e/></root>";
+
+        // consecutive data events are merged, since data may be reported in pieces.
+        auto normalize = [](auto parsed) {
+            decltype(parsed) res;
+            for (auto& ev : parsed) {
+                if (!res.empty() && std::get<0>(ev) == MyXml::DATA && std::get<0>(res.back()) == MyXml::DATA)
+                    std::get<1>(res.back()) += std::get<1>(ev);
+                else
+                    res.push_back(ev);
+            }
+            return res;
+        };
+        MyXml whole;
+        whole.parse(doc);
+        CHECK(whole.parsed.size() == 8);
+
+        for (size_t split = 0 ; split <= doc.size() ; split++) {
+            INFO("split at " << split);
+            MyXml tst;
+            tst.feed(doc.data(), doc.data() + split);
+            tst.feed(doc.data() + split, doc.data() + doc.size());
+            tst.finish();
+            CHECK(normalize(tst.parsed) == whole.parsed);
+        }
+
+        // one byte at a time, from a reader.
+        MyXml tst;
+        size_t pos = 0;
+        tst.feedall([&](char *buf, size_t size) {
+            if (pos == doc.size())
+                return size_t(0);
+            *buf = doc[pos++];
+            return size_t(1);
+        }, 1);
+        tst.finish();
+        CHECK(normalize(tst.parsed) == whole.parsed);
+
+        // long comments and cdata sections, with their end split at every position.
+        std::string longdoc = "<root><!--" + std::string(5000, 'x') + "- -- >--><![CDATA[" + std::string(5000, 'y') + "] ]] >]]></root>";
+        MyXml longwhole;
+        longwhole.parse(longdoc);
+        for (size_t chunk = 1 ; chunk <= 7 ; chunk++) {
+            INFO("chunk " << chunk);
+            MyXml tst;
+            for (size_t ofs = 0 ; ofs < longdoc.size() ; ofs += chunk)
+                tst.feed(longdoc.data() + ofs, longdoc.data() + std::min(ofs + chunk, longdoc.size()));
+            tst.finish();
+            CHECK(normalize(tst.parsed) == longwhole.parsed);
+        }
+    }
+    TEST_CASE("streaming-errors") {
+        MyXml tst;
+        tst.feed("<a k='v"s);
+        CHECK_THROWS(tst.finish());
+
+        // the parser can be reused after an error.
+        tst.parsed.clear();
+        tst.feed("<a/>"s);
+        CHECK_NOTHROW(tst.finish());
+        CHECK(tst.parsed == tst.mk(MyXml::ELEM, "a"));
+
+        MyXml tst2;
+        tst2.feed("<a><!-- x"s);
+        CHECK_THROWS(tst2.finish());
+
+        MyXml tst3;
+        tst3.feed("<a k='v' = "s);
+        CHECK_THROWS(tst3.finish());
+    }
+    TEST_CASE("xmlscan") {
+        // compare with scalar versions, at all offsets relative to the 64 byte blocks.
+        const char alphabet[] = "ab:_-.9 \t\n\r\v\f<>='\"/&;!?\x80\xff\x7f\x01";
+        std::string buf;
+        for (int i = 0 ; i < 300 ; i++)
+            buf += alphabet[(i * 7919 + i / 3) % (sizeof(alphabet) - 1)];
+        auto isname = [](char c) { return XmlParserBase::isnamechar(c); };
+        for (size_t ofs = 0 ; ofs < 70 ; ofs++) {
+            INFO("offset " << ofs);
+            for (size_t len : { 0, 1, 15, 63, 64, 65, 128, 200 }) {
+                const char *first = buf.data() + ofs;
+                const char *last = first + std::min(len, buf.size() - ofs);
+                // restrict the searched ranges, so the character is found at various positions.
+                for (size_t skip = 0 ; skip < size_t(last - first) ; skip += 13) {
+                    const char *p = first + skip;
+                    CHECK(xmlscan::find_char(p, last, '<') == std::find(p, last, '<'));
+                    CHECK(xmlscan::find_nonspace(p, last) == std::find_if(p, last, [](char c) { return !xmlscan::isspace(c); }));
+                    CHECK(xmlscan::find_nonname(p, last) == std::find_if_not(p, last, isname));
+                    CHECK(xmlscan::find_structural(p, last) == std::find_if(p, last, xmlscan::isstructural));
+                }
+                std::vector<uint32_t> positions, expected;
+                xmlscan::index(first, last, positions);
+                for (auto p = first ; p < last ; p++)
+                    if (xmlscan::isstructural(*p))
+                        expected.push_back(p - first);
+                CHECK(positions == expected);
+            }
+        }
+        // only space, tab, newline and carriage return are xml whitespace.
+        for (int c = 0 ; c < 256 ; c++)
+            CHECK(xmlscan::isspace(char(c)) == (c == ' ' || c == '\t' || c == '\n' || c == '\r'));
+        std::string vtab(20, ' ');
+        vtab[17] = '\v';
+        CHECK(xmlscan::find_nonspace(vtab.data(), vtab.data() + vtab.size()) == vtab.data() + 17);
+        XmlParser tst;
+        CHECK_NOTHROW(tst.parse("<a\r\n\tx='1'\t/>"s));
+        CHECK_THROWS(tst.parse("<a\fx='1'/>"s));
+
+        std::string longspace(100, ' ');
+        CHECK(xmlscan::find_nonspace(longspace.data(), longspace.data() + 100) == longspace.data() + 100);
+        std::string cmt = std::string(100, '-') + "->";
+        CHECK(xmlscan::find_str(cmt.data(), cmt.data() + cmt.size(), "-->") == cmt.data() + 99);
+        CHECK(xmlscan::find_str(cmt.data(), cmt.data() + 101, "-->") == cmt.data() + 101);
+    }
+    TEST_CASE("entities") {
+        CHECK(XmlParser::decode_entities("a &lt;b&gt; &amp; &quot;c&apos;"s) == "a <b> & \"c'");
+        CHECK(XmlParser::decode_entities("&#65;&#x42;&#X43;&#0000068;"s) == "ABCD");
+        CHECK(XmlParser::decode_entities("&#xe9;&#x20ac;&#128512;"s) == "\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+        // malformed or unknown references are kept
+        for (auto s : { "&", "a & b", "&amp", "&unknown;", "&#;", "&#x;", "&#12a;", "&#x110000;", "&#xd800;", "&#0;", "&#99999999999999;" })
+            CHECK(XmlParser::decode_entities(std::string(s)) == s);
+        CHECK(XmlParser::decode_entities("&&amp;;"s) == "&&;");
+
+        CHECK(XmlParser::encode_entities("a<b>&\"c'"s) == "a&lt;b&gt;&amp;&quot;c'");
+        std::string longtext(100, 'x');
+        CHECK(XmlParser::encode_entities(longtext + "&" + longtext) == longtext + "&amp;" + longtext);
+        CHECK(XmlParser::decode_entities(XmlParser::encode_entities(longtext + "<&>\"" + longtext)) == longtext + "<&>\"" + longtext);
+
+        // without entities, the input is returned, without copying
+        std::string buf;
+        std::string_view plain = "no entities here, but long enough for the vectorized scan";
+        CHECK(XmlParser::decode_entities(plain, buf).data() == plain.data());
+        CHECK(XmlParser::encode_entities(plain, buf).data() == plain.data());
+        CHECK(buf.empty());
+        CHECK(XmlParser::decode_entities("x&amp;y", buf) == "x&y");
+        CHECK(buf == "x&y");
+
+        XmlAttribute a{ "k", "1 &lt; 2" };
+        CHECK(a.value() == "1 < 2");
+        CHECK(a.value(buf) == "1 < 2");
+        XmlAttribute b{ "k", "plain" };
+        CHECK(b.value(buf).data() == b.raw.data());
     }
 };
@@ -85,6 +85,15 @@ TEST_CASE("xmltree-6") {   // empty string
 
     CHECK(!tree.validate());
 }
-
-
-
+TEST_CASE("xmltree-entities") {
+    XmlNodeTree tree;
+    using namespace std::string_literals;
+    tree.parse("<a k=\"x &lt; &quot;y&quot; &amp;amp;\" l='&#65;'>text</a>"s);
+
+    auto root = tree.root();
+    REQUIRE(root);
+    CHECK(root->find_attr("k") == "x < \"y\" &amp;");
+    CHECK(root->find_attr("l") == "A");
+    // attribute values are escaped again when writing
+    CHECK(root->asxml() == "<a k=\"x &lt; &quot;y&quot; &amp;amp;\" l=\"A\">text</a>");
+}